@@ -17,6 +17,7 @@
 #include <array>
 #include <cassert>
 #include <cstdint>
+#include <type_traits>
 
 #include "gfxmath.hh"
 
@@ -31,8 +32,13 @@ namespace gfx {
   class color_depth {
   public:
 
-    // Type aliases.
+    // Type aliases. accumulator_type is wide enough to hold a sum of
+    // many intensities without overflow or significant rounding: a
+    // 64-bit integer for integral components, otherwise double.
     using component_type = component_type_parameter;
+    using accumulator_type = typename std::conditional<std::is_integral<component_type>::value,
+						       int64_t,
+						       double>::type;
     static constexpr component_type max_value = max_value_int_parameter;
     static constexpr int max_value_int = max_value_int_parameter;
     static constexpr double max_value_double = max_value_int_parameter;
@@ -163,10 +169,6 @@ namespace gfx {
 				    xvert(green()),
 				    xvert(blue()));
     }
-
-  private:
-
-    std::array<color_component_type, 3> _components;
   };
 
   // Aliases for widely-used color depths.
@@ -175,6 +177,14 @@ namespace gfx {
 
   using hdr_rgb = gfx::rgb<hdr_color_depth>;
 
+  // Images store rgb objects back-to-back and PPM I/O copies raw
+  // bytes to and from them, so an rgb must be exactly three packed
+  // components with no padding and no extra data members.
+  static_assert(sizeof(true_color_rgb) == 3 * sizeof(uint8_t),
+		"true_color_rgb must be 3 packed bytes");
+  static_assert(sizeof(hdr_rgb) == 3 * sizeof(float),
+		"hdr_rgb must be 3 packed floats");
+
   // Function to convert a 24-bit hexadecimal HTML color code into a
   // true_color_rgb object.
   true_color_rgb hex_color(int hex) {
@@ -5,12 +5,29 @@
 	//
 	//     - clear one of the three RGB components;
 	//     - scale one of the components;
+	//     - map one of the components through a lookup table;
 	//     - crop;
 	//     - extend edges;
 	//     - crop extended edges;
-	//     - convert color to grayscale;
-	//     - Sobel edge detection; and
-	//     - box blur.
+	//     - convert color to grayscale, with vectorized kernels and a
+	//       choice of luminance weights;
+	//     - any chain of the per-pixel filters above, and custom per-pixel
+	//       operations, fused into a single pass (pixel_pipeline);
+	//     - Sobel edge detection;
+	//     - box blur; and
+	//     - convolution with an arbitrary compile-time-sized kernel,
+	//       including a fast path for separable kernels.
+	//
+	// Every filter reads its input through a gfx::image_view, so an
+	// image, or a view of part of one, may be passed as "before". The
+	// "before" view must not refer to the pixels of "after".
+	//
+	// Every filter that writes into "after" also has an overload whose
+	// first argument is a gfx::execution_policy (see gfxthread.hh), which
+	// runs it on a thread pool. Per-pixel filters work one tile at a
+	// time, box blur one strip of whole columns at a time, and the rest
+	// one band of whole rows at a time. The result is identical to the
+	// overload without a policy, which runs on the calling thread.
 	//
 	// This module builds on gfximage.hh, so familiarize yourself with
 	// that file before using this one.
@@ -20,9 +37,15 @@
 	#pragma once
 
 	#include <algorithm>
+	#include <array>
 	#include <cmath>
+	#include <cstdint>
 	#include <iostream>
+	#include <type_traits>
+	#include <vector>
 	#include "gfximage.hh"
+	#include "gfxsimd.hh"
+	#include "gfxthread.hh"
 	using namespace std;
 
 	namespace gfx {
@@ -33,10 +56,12 @@
 		// then every red component in after is zero, while the green and
 		// blue components are copied over from before unchanged. before
 		// must be non-empty, and component_to_clear must be a valid rgb
-		// index.
+		// index. The pixels are processed in tiles according to policy
+		// (see gfx::execution_policy).
 		template <typename color_depth>
-		void clear_component(gfx::image<color_depth>& after,
-						 const gfx::image<color_depth>& before,
+		void clear_component(const execution_policy& policy,
+						 gfx::image<color_depth>& after,
+						 const gfx::input_view<color_depth>& before,
 						 rgb_index component_to_clear) {
 
 			// Check arguments.
@@ -46,20 +71,163 @@
 			// Resize after to the necessary dimensions.
 			after.same_size(before);
 
-			// Loop through all pixel coordinates.
-			for (int y = 0; y < before.height(); ++y) {
-				for (int x = 0; x < before.width(); ++x) {
+			// Loop through all pixel coordinates, one tile at a time.
+			for_each_tile(policy, before.width(), before.height(), [&](const tile& t){
+				for (int y = t.top; y < t.top + t.height; ++y) {
+					for (int x = t.left; x < t.left + t.width; ++x) {
 
-		// Make a copy of the "before" pixel color.
-		gfx::rgb<color_depth> pixel = before.pixel(x, y);
+						// Make a copy of the "before" pixel color.
+						gfx::rgb<color_depth> pixel = before.pixel(x, y);
 
-		// Clear the desired component.
-		pixel[component_to_clear] = 0;
+						// Clear the desired component.
+						pixel[component_to_clear] = 0;
 
-		// Copy the resulting pixel into the "after" image object.
-		after.pixel(x, y) = pixel;
+						// Copy the resulting pixel into the "after" image object.
+						after.pixel(x, y) = pixel;
+					}
 				}
-			}
+			});
+		}
+
+		// Clear one color component on the calling thread.
+		template <typename color_depth>
+		void clear_component(gfx::image<color_depth>& after,
+						 const gfx::input_view<color_depth>& before,
+						 rgb_index component_to_clear) {
+			clear_component(sequential(), after, before, component_to_clear);
+		}
+
+		// Clear one color component, returning the result by value. before
+		// may be an image or an image_view.
+		template <typename input_type>
+		gfx::image<typename input_type::color_depth> clear_component(const input_type& before,
+								       rgb_index component_to_clear) {
+			gfx::image<typename input_type::color_depth> after;
+			clear_component(after, before, component_to_clear);
+			return after;
+		}
+
+		// A lookup table for the components of an integral color depth:
+		// entry v is the new value of a component whose value was v.
+		template <typename color_depth>
+		using lookup_table = std::array<typename color_depth::component_type, color_depth::max_value_int + 1>;
+
+		// Return the lookup table whose entry v is f(v).
+		template <typename color_depth, typename function>
+		lookup_table<color_depth> make_lookup_table(function f) {
+			static_assert(std::is_integral<typename color_depth::component_type>::value,
+				      "lookup tables need an integral color depth");
+			lookup_table<color_depth> table;
+			for(int v=0;v<=color_depth::max_value_int;v++)
+				table[v]=f(typename color_depth::component_type(v));
+			return table;
+		}
+
+		// Apply a lookup table to one color component. Make after contain
+		// a copy of before, except that every component intensity v has
+		// been replaced with table[v]. The color depth must be integral,
+		// and every entry of table must be a valid intensity. before must
+		// be non-empty, and component must be a valid rgb index. The
+		// pixels are processed in tiles according to policy (see
+		// gfx::execution_policy).
+		//
+		// This costs one load per sample with no arithmetic, so any
+		// per-intensity mapping of an 8-bit image, such as a curve, a
+		// gamma correction or a threshold, can be done this way.
+		template <typename color_depth>
+		void apply_lut(const execution_policy& policy,
+			       gfx::image<color_depth>& after,
+			       const gfx::input_view<color_depth>& before,
+			       rgb_index component,
+			       const lookup_table<color_depth>& table) {
+
+			static_assert(std::is_integral<typename color_depth::component_type>::value,
+				      "lookup tables need an integral color depth");
+			using component_type = typename color_depth::component_type;
+
+			// Check arguments.
+			assert(!before.empty());
+			assert(is_rgb_index(component));
+
+			after.same_size(before);
+			for_each_tile(policy, before.width(), before.height(), [&](const tile& t){
+				for(int y=t.top;y<t.top+t.height;y++){
+
+					//an rgb is three packed components, so the tile's part of a row is 3*t.width of them
+					const component_type* source=&before.row(y)[t.left][0];
+					component_type* destination=&after.row(y)[t.left][0];
+					std::copy(source, source+3*t.width, destination);
+					for(int x=component;x<3*t.width;x+=3)
+						destination[x]=table[destination[x]];
+				}
+			});
+		}
+
+		// Apply a lookup table on the calling thread.
+		template <typename color_depth>
+		void apply_lut(gfx::image<color_depth>& after,
+			       const gfx::input_view<color_depth>& before,
+			       rgb_index component,
+			       const lookup_table<color_depth>& table) {
+			apply_lut(sequential(), after, before, component, table);
+		}
+
+		// Apply a lookup table, returning the result by value. before may
+		// be an image or an image_view.
+		template <typename input_type>
+		gfx::image<typename input_type::color_depth> apply_lut(const input_type& before,
+								 rgb_index component,
+								 const lookup_table<typename input_type::color_depth>& table) {
+			gfx::image<typename input_type::color_depth> after;
+			apply_lut(after, before, component, table);
+			return after;
+		}
+
+		// Whether color_depth has 8-bit integral components, so that a
+		// lookup table covers all of its intensities cheaply.
+		template <typename color_depth>
+		struct has_8_bit_components
+			: std::integral_constant<bool, std::is_integral<typename color_depth::component_type>::value &&
+						       (sizeof(typename color_depth::component_type) == 1)> { };
+
+		// Return the lookup table of intensities multiplied by
+		// scale_factor, with the same arithmetic and clamping as
+		// scale_component.
+		template <typename color_depth>
+		lookup_table<color_depth> scale_component_table(double scale_factor) {
+			using component_type = typename color_depth::component_type;
+			return make_lookup_table<color_depth>([&](component_type v){
+				float scaled=color_depth::template convert_to<hdr_color_depth>(v)*scale_factor,
+					clamped=std::min(scaled, 1.0f);
+				return hdr_color_depth::convert_to<color_depth>(clamped);
+			});
+		}
+
+		// scale_component for color depths with 8-bit components. Each has
+		// only 256 possible intensities, so build a table of the scaled
+		// ones and apply that. The other components are copied unchanged,
+		// which matches scale_component because converting an 8-bit
+		// intensity to HDR and back gives the same intensity. Return
+		// false, without doing anything, for other color depths.
+		template <typename color_depth>
+		bool scale_component_by_table(const execution_policy& policy,
+					      gfx::image<color_depth>& after,
+					      const gfx::input_view<color_depth>& before,
+					      rgb_index component_to_scale,
+					      double scale_factor,
+					      std::true_type) {
+			apply_lut(policy, after, before, component_to_scale, scale_component_table<color_depth>(scale_factor));
+			return true;
+		}
+
+		template <typename color_depth>
+		bool scale_component_by_table(const execution_policy&,
+					      gfx::image<color_depth>&,
+					      const gfx::input_view<color_depth>&,
+					      rgb_index,
+					      double,
+					      std::false_type) {
+			return false;
 		}
 
 		// Scale one color component. Make after contain a copy of before,
@@ -69,10 +237,14 @@
 		// component is increased 150%. The resulting intensity values are
 		// clamped into the range [0, color_depth::max_value]. before must
 		// be non-empty, component_to_scale must be a valid rgb index, and
-		// scale_factor must be non-negative.
+		// scale_factor must be non-negative. The pixels are processed in
+		// tiles according to policy (see gfx::execution_policy). For 8-bit color
+		// depths the scaled intensities are looked up in a table (see
+		// apply_lut), with identical results.
 		template <typename color_depth>
-		void scale_component(gfx::image<color_depth>& after,
-						 const gfx::image<color_depth>& before,
+		void scale_component(const execution_policy& policy,
+						 gfx::image<color_depth>& after,
+						 const gfx::input_view<color_depth>& before,
 						 rgb_index component_to_scale,
 						 double scale_factor) {
 
@@ -81,49 +253,79 @@
 			assert(is_rgb_index(component_to_scale));
 			assert(scale_factor >= 0.0);
 
+			// 8-bit components are looked up in a table instead.
+			if (scale_component_by_table(policy, after, before, component_to_scale, scale_factor,
+						     has_8_bit_components<color_depth>()))
+				return;
+
 			// Resize after to the necessary dimensions.
 			after.same_size(before);
 
-			// Loop through all pixel coordinates.
-			for (int y = 0; y < before.height(); ++y) {
-				for (int x = 0; x < before.width(); ++x) {
+			// Loop through all pixel coordinates, one tile at a time.
+			for_each_tile(policy, before.width(), before.height(), [&](const tile& t){
+				for (int y = t.top; y < t.top + t.height; ++y) {
+					for (int x = t.left; x < t.left + t.width; ++x) {
 
-		// Get a copy of the original pixel.
-		gfx::rgb<color_depth> original_pixel = before.pixel(x, y);
+						// Get a copy of the original pixel.
+						gfx::rgb<color_depth> original_pixel = before.pixel(x, y);
 
-		// Convert that pixel to HDR, so that we can do the scale
-		// arithmetic using floating-point data types. Note the
-		// peculiar syntax needed to instantiate the convert_to
-		// template function.
-		gfx::hdr_rgb hdr_pixel = original_pixel.template convert_to<hdr_color_depth>();
+						// Convert that pixel to HDR, so that we can do the scale
+						// arithmetic using floating-point data types. Note the
+						// peculiar syntax needed to instantiate the convert_to
+						// template function.
+						gfx::hdr_rgb hdr_pixel = original_pixel.template convert_to<hdr_color_depth>();
 
-		// first do the scale multiplication...
-		float scaled = hdr_pixel[component_to_scale] * scale_factor,
-			// then make sure it does not exceed the max value.
-			clamped = std::min(scaled, 1.0f);
-		assert(clamped >= 0.0);
-		assert(clamped <= 1.0);
+						// first do the scale multiplication...
+						float scaled = hdr_pixel[component_to_scale] * scale_factor,
+							// then make sure it does not exceed the max value.
+							clamped = std::min(scaled, 1.0f);
+						assert(clamped >= 0.0);
+						assert(clamped <= 1.0);
 
-		// Overwrite the un-scaled intensity with the scaled one.
-		hdr_pixel[component_to_scale] = clamped;
+						// Overwrite the un-scaled intensity with the scaled one.
+						hdr_pixel[component_to_scale] = clamped;
 
-		// Convert this HDR pixel to match the desired output color
-		// depth.
-		gfx::rgb<color_depth> result_pixel = hdr_pixel.convert_to<color_depth>();
+						// Convert this HDR pixel to match the desired output color
+						// depth.
+						gfx::rgb<color_depth> result_pixel = hdr_pixel.convert_to<color_depth>();
 
-		// Write the resulting pixel to the "after" image.
-		after.pixel(x, y) = result_pixel;
+						// Write the resulting pixel to the "after" image.
+						after.pixel(x, y) = result_pixel;
+					}
 				}
-			}
+			});
+		}
+
+		// Scale one color component on the calling thread.
+		template <typename color_depth>
+		void scale_component(gfx::image<color_depth>& after,
+						 const gfx::input_view<color_depth>& before,
+						 rgb_index component_to_scale,
+						 double scale_factor) {
+			scale_component(sequential(), after, before, component_to_scale, scale_factor);
+		}
+
+		// Scale one color component, returning the result by value. before
+		// may be an image or an image_view.
+		template <typename input_type>
+		gfx::image<typename input_type::color_depth> scale_component(const input_type& before,
+								       rgb_index component_to_scale,
+								       double scale_factor) {
+			gfx::image<typename input_type::color_depth> after;
+			scale_component(after, before, component_to_scale, scale_factor);
+			return after;
 		}
 
 		// Crop. Make after contain the pixels from the rectangular region
 		// of before, with the specified top-left corner, width, and
 		// height. before must be non-empty, width and height must both be
-		// positive, and the entire rectangle must fit inside before.
+		// positive, and the entire rectangle must fit inside before. To
+		// crop without copying, use image_view::subview instead. The rows
+		// are copied according to policy (see gfx::execution_policy).
 		template <typename color_depth>
-		void crop(gfx::image<color_depth>& after,
-				const gfx::image<color_depth>& before,
+		void crop(const execution_policy& policy,
+				gfx::image<color_depth>& after,
+				const gfx::input_view<color_depth>& before,
 				int left,
 				int top,
 				int width,
@@ -138,12 +340,37 @@
 			assert(before.is_x(left + width - 1));
 			assert(before.is_y(top + height - 1));
 
-			after.resize(width, height, BLACK.convert_to<color_depth>());
+			after.resize(width, height);
+			for_each_band(policy, height, DEFAULT_BAND_HEIGHT, [&](int y_begin, int y_end){
+				for(int y=y_begin;y<y_end;y++){
+					const gfx::rgb<color_depth>* source=before.row(top+y)+left;
+					std::copy(source, source+width, after.row(y));
+				}
+			});
+		}
 
-			for(int i=0;i<height;i++)
-				for(int j=0;j<width;j++)
-					after.pixel(j,i)=before.pixel(left+j,top+i);
+		// Crop on the calling thread.
+		template <typename color_depth>
+		void crop(gfx::image<color_depth>& after,
+				const gfx::input_view<color_depth>& before,
+				int left,
+				int top,
+				int width,
+				int height) {
+			crop(sequential(), after, before, left, top, width, height);
+		}
 
+		// Crop, returning the result by value. before may be an image or
+		// an image_view.
+		template <typename input_type>
+		gfx::image<typename input_type::color_depth> crop(const input_type& before,
+							    int left,
+							    int top,
+							    int width,
+							    int height) {
+			gfx::image<typename input_type::color_depth> after;
+			crop(after, before, left, top, width, height);
+			return after;
 		}
 
 		// Extend the edges of an image. This is intended to be used as a
@@ -185,10 +412,12 @@
 		//    after.width()  == before.width()  + 2 * pad_radius
 		//    after.height() == before.height() + 2 * pad_radius
 		//
-		// before must be non-empty, and pad_radius must be positive.
+		// before must be non-empty, and pad_radius must be positive. The
+		// rows are filled according to policy (see gfx::execution_policy).
 		template <typename color_depth>
-		void extend_edges(gfx::image<color_depth>& after,
-					const gfx::image<color_depth>& before,
+		void extend_edges(const execution_policy& policy,
+					gfx::image<color_depth>& after,
+					const gfx::input_view<color_depth>& before,
 					int pad_radius) {
 
 			// Check arguments.
@@ -196,170 +425,1270 @@
 			assert(pad_radius > 0);
 
 			//resize the image
-			int endwidth=before.width()+2*pad_radius;
-			int endheight=before.height()+2*pad_radius;
-			after.resize(endwidth, endheight);
-
-			/*check size
-			cout<<endl<<pad_radius<<endl;
-			cout<<endl<<before.width()<<" "<<before.height()<<endl;
-			cout<<endl<<after.width()<<" "<<after.height()<<endl;
-			*/
-
-			//put the image in the middle
-			for(int i=0;i<before.height();i++)
-				for(int j=0;j<before.width();j++)
-					after.pixel(j+pad_radius,i+pad_radius)=before.pixel(j,i);
-
-			//corners first...
-			//section a top left
-			for(int i=0;i<pad_radius;i++)
-				for(int j=0;j<pad_radius;j++)
-					after.pixel(j,i)=before.pixel(0,0);
-
-			//section c top right
-			for(int i=0;i<pad_radius;i++)
-				for(int j=0;j<pad_radius;j++)
-					after.pixel(j+before.width()+pad_radius,i)=before.pixel(before.width()-1,0);
-
-			//section g bottom left
-			for(int i=0;i<pad_radius;i++)
-				for(int j=0;j<pad_radius;j++)
-					after.pixel(j,i+before.height()+pad_radius)=before.pixel(0,before.height()-1);
-
-			//section i bottom right
-			for(int i=0;i<pad_radius;i++)
-				for(int j=0;j<pad_radius;j++)
-					after.pixel(j+before.width()+pad_radius,i+before.height()+pad_radius)=before.pixel(before.width()-1,before.height()-1);
-
-			//middle sections...
-			//section b top
-			for(int i=0;i<pad_radius;i++)
-				for(int j=0;j<before.width();j++)
-					after.pixel(j+pad_radius,i)=before.pixel(j,0);
-
-			//section h bottom
-			for(int i=0;i<pad_radius;i++)
-				for(int j=0;j<before.width();j++)
-					after.pixel(j+pad_radius,i+before.height()+pad_radius)=before.pixel(j,before.height()-1);
-
-			//section d left
-			for(int i=0;i<before.height();i++)
-				for(int j=0;j<pad_radius;j++)
-					after.pixel(j,i+pad_radius)=before.pixel(0,i);
-
-			//section f right
-			for(int i=0;i<before.height();i++)
-				for(int j=0;j<pad_radius;j++){
-					int x=j+before.width()+pad_radius;
-					int y=i+pad_radius;
-					after.pixel(x,y)=before.pixel(before.width()-1,i);
+			const int width=before.width(), height=before.height();
+			after.resize(width+2*pad_radius, height+2*pad_radius);
+
+			//every row of after is the nearest row of before (E, or B and H above and below it) with its end pixels repeated into D and F (or A, C, G and I)
+			for_each_band(policy, after.height(), DEFAULT_BAND_HEIGHT, [&](int y_begin, int y_end){
+				for(int y=y_begin;y<y_end;y++){
+					const gfx::rgb<color_depth>* source=before.row(std::min(std::max(y-pad_radius,0),height-1));
+					gfx::rgb<color_depth>* destination=after.row(y);
+					std::fill(destination, destination+pad_radius, source[0]);
+					std::copy(source, source+width, destination+pad_radius);
+					std::fill(destination+pad_radius+width, destination+2*pad_radius+width, source[width-1]);
 				}
+			});
+		}
+
+		// Extend the edges of an image on the calling thread.
+		template <typename color_depth>
+		void extend_edges(gfx::image<color_depth>& after,
+					const gfx::input_view<color_depth>& before,
+					int pad_radius) {
+			extend_edges(sequential(), after, before, pad_radius);
+		}
+
+		// Extend the edges of an image, returning the result by
+		// value. before may be an image or an image_view.
+		template <typename input_type>
+		gfx::image<typename input_type::color_depth> extend_edges(const input_type& before,
+								    int pad_radius) {
+			gfx::image<typename input_type::color_depth> after;
+			extend_edges(after, before, pad_radius);
+			return after;
 		}
 
 		// Crop away the padding created by extend_edges. If before was
 		// created with extend_edges, then after will be filled with the
 		// original image labeled E in the description for extend_edges. In
 		// other words, crop_extended_edges un-does extend_edges. before
-		// must be non-empty and pad_radius must be positive.
+		// must be non-empty and pad_radius must be positive. The rows are
+		// copied according to policy (see gfx::execution_policy).
 		template <typename color_depth>
-		void crop_extended_edges(gfx::image<color_depth>& after,
-					 const gfx::image<color_depth>& before,
+		void crop_extended_edges(const execution_policy& policy,
+					 gfx::image<color_depth>& after,
+					 const gfx::input_view<color_depth>& before,
 					 int pad_radius) {
 
 			// Check arguments.
 			assert(!before.empty());
 			assert(pad_radius > 0);
 
-			crop(after,before,pad_radius,pad_radius,before.width()-2*pad_radius,before.height()-2*pad_radius);
+			crop(policy,after,before,pad_radius,pad_radius,before.width()-2*pad_radius,before.height()-2*pad_radius);
+		}
+
+		// Crop away extended edges on the calling thread.
+		template <typename color_depth>
+		void crop_extended_edges(gfx::image<color_depth>& after,
+					 const gfx::input_view<color_depth>& before,
+					 int pad_radius) {
+			crop_extended_edges(sequential(), after, before, pad_radius);
+		}
+
+		// Crop away extended edges, returning the result by value. before
+		// may be an image or an image_view.
+		template <typename input_type>
+		gfx::image<typename input_type::color_depth> crop_extended_edges(const input_type& before,
+									   int pad_radius) {
+			gfx::image<typename input_type::color_depth> after;
+			crop_extended_edges(after, before, pad_radius);
+			return after;
+		}
+
+		// The weights luminance and grayscale give to red, green and
+		// blue.
+		enum luminance_weights { LUMINANCE_DEFAULT = 0, // .2, .7, .1
+					 LUMINANCE_REC_601 = 1, // .299, .587, .114, as in SDTV and JPEG
+					 LUMINANCE_REC_709 = 2 }; // .2126, .7152, .0722, as in HDTV and sRGB
+
+		// Return the red, green and blue weights of weights in 16-bit
+		// fixed point (65536 is 1), rounded so that they add up to 65536.
+		const uint16_t* fixed_point_luminance_weights(luminance_weights weights) {
+			static const uint16_t table[3][3]={{13107, 45875, 6554},
+							  {19595, 38470, 7471},
+							  {13933, 46871, 4732}};
+			assert(weights>=LUMINANCE_DEFAULT && weights<=LUMINANCE_REC_709);
+			return table[weights];
+		}
+
+		// Return the red, green and blue weights of weights as floats.
+		const float* float_luminance_weights(luminance_weights weights) {
+			static const float table[3][3]={{.2f, .7f, .1f},
+						       {.299f, .587f, .114f},
+						       {.2126f, .7152f, .0722f}};
+			assert(weights>=LUMINANCE_DEFAULT && weights<=LUMINANCE_REC_709);
+			return table[weights];
+		}
+
+		// luminance for 8-bit, float and other color depths.
+		template <typename color_depth>
+		typename color_depth::component_type luminance(const gfx::rgb<color_depth>& pixel,
+							      luminance_weights weights,
+							      std::true_type, std::false_type) {
+			return fixed_point_gray(pixel.red(), pixel.green(), pixel.blue(), fixed_point_luminance_weights(weights));
+		}
+
+		template <typename color_depth>
+		typename color_depth::component_type luminance(const gfx::rgb<color_depth>& pixel,
+							      luminance_weights weights,
+							      std::false_type, std::true_type) {
+			return float_gray(pixel.red(), pixel.green(), pixel.blue(), float_luminance_weights(weights));
+		}
+
+		template <typename color_depth>
+		typename color_depth::component_type luminance(const gfx::rgb<color_depth>& pixel,
+							      luminance_weights weights,
+							      std::false_type, std::false_type) {
+			const float* w=float_luminance_weights(weights);
+			return pixel.red()*w[0]+pixel.green()*w[1]+pixel.blue()*w[2];
+		}
+
+		// Return the gray intensity with approximately the same perceived
+		// luminance as pixel, the sum of its components times weights.
+		// This is the value grayscale assigns to every component, and the
+		// input to edge_detect. 8-bit components are weighted in fixed
+		// point (see gfx::fixed_point_gray) and float ones in float;
+		// with the default weights an 8-bit intensity is exactly
+		// the sum truncated to an integer.
+		template <typename color_depth>
+		typename color_depth::component_type luminance(const gfx::rgb<color_depth>& pixel,
+							      luminance_weights weights = LUMINANCE_DEFAULT) {
+			return luminance(pixel, weights, has_8_bit_components<color_depth>(),
+					 std::is_same<typename color_depth::component_type, float>());
+		}
+
+		// Set pixels [0, width) of destination to the grayscale of the
+		// same pixels of source, for 8-bit, float and other color
+		// depths. The first two run the vectorized kernels of gfxsimd.hh .
+		template <typename color_depth>
+		void grayscale_row(const gfx::rgb<color_depth>* source,
+				   gfx::rgb<color_depth>* destination,
+				   int width,
+				   luminance_weights weights,
+				   std::true_type, std::false_type) {
+			//an rgb is three packed components, so a row is 3*width of them
+			gray_row(reinterpret_cast<const uint8_t*>(&source[0][0]),
+				 reinterpret_cast<uint8_t*>(&destination[0][0]),
+				 width, fixed_point_luminance_weights(weights));
+		}
+
+		template <typename color_depth>
+		void grayscale_row(const gfx::rgb<color_depth>* source,
+				   gfx::rgb<color_depth>* destination,
+				   int width,
+				   luminance_weights weights,
+				   std::false_type, std::true_type) {
+			gray_row(&source[0][0], &destination[0][0], width, float_luminance_weights(weights));
+		}
+
+		template <typename color_depth>
+		void grayscale_row(const gfx::rgb<color_depth>* source,
+				   gfx::rgb<color_depth>* destination,
+				   int width,
+				   luminance_weights weights,
+				   std::false_type, std::false_type) {
+			for(int x=0;x<width;x++){
+				typename color_depth::component_type gray=luminance(source[x], weights);
+				destination[x].assign(gray,gray,gray);
+			}
 		}
 
 		// Convert from color to grayscale. after is filled with a version
 		// of before, where each rgb is converted into a grayscale (aka
 		// semitone) with approximately the same perceived luminance as the
-		// source pixel. before must be non-empty.
+		// source pixel, as computed by luminance with weights. before must
+		// be non-empty. The pixels are processed in tiles according to
+		// policy (see gfx::execution_policy).
+		//
+		// For 8-bit and float color depths each row of a tile goes through
+		// a vectorized kernel, SSE2 or AVX2 as the CPU allows (see
+		// gfxsimd.hh), whose results are identical to luminance.
+		template <typename color_depth>
+		void grayscale(const execution_policy& policy,
+			 gfx::image<color_depth>& after,
+			 const gfx::input_view<color_depth>& before,
+			 luminance_weights weights = LUMINANCE_DEFAULT) {
+
+			// Check arguments.
+			assert(!before.empty());
+
+			after.same_size(before);
+			for_each_tile(policy, before.width(), before.height(), [&](const tile& t){
+				for(int y=t.top;y<t.top+t.height;y++)
+					grayscale_row(before.row(y)+t.left, after.row(y)+t.left, t.width, weights,
+						      has_8_bit_components<color_depth>(),
+						      std::is_same<typename color_depth::component_type, float>());
+			});
+		}
+
+		// Convert from color to grayscale on the calling thread.
 		template <typename color_depth>
 		void grayscale(gfx::image<color_depth>& after,
-			 const gfx::image<color_depth>& before) {
+			 const gfx::input_view<color_depth>& before,
+			 luminance_weights weights = LUMINANCE_DEFAULT) {
+			grayscale(sequential(), after, before, weights);
+		}
+
+		// Convert from color to grayscale, returning the result by
+		// value. before may be an image or an image_view.
+		template <typename input_type>
+		gfx::image<typename input_type::color_depth> grayscale(const input_type& before,
+								 luminance_weights weights = LUMINANCE_DEFAULT) {
+			gfx::image<typename input_type::color_depth> after;
+			grayscale(after, before, weights);
+			return after;
+		}
+
+		// Point operations, for use with gfx::pixel_pipeline. Each one
+		// changes a single pixel in place, the same way as the filter it is
+		// named after. WORKS_IN_HDR says whether it takes the pixel as an
+		// hdr_rgb, or in the image's own color depth.
+
+		// The per-pixel step of clear_component.
+		struct clear_component_op {
+			static const bool WORKS_IN_HDR = false;
+			rgb_index component;
+
+			explicit clear_component_op(rgb_index component_to_clear)
+				: component(component_to_clear) {
+				assert(is_rgb_index(component_to_clear));
+			}
+
+			template <typename color_depth>
+			void operator()(gfx::rgb<color_depth>& pixel) const {
+				pixel[component]=0;
+			}
+		};
+
+		// The per-pixel step of scale_component.
+		struct scale_component_op {
+			static const bool WORKS_IN_HDR = true;
+			rgb_index component;
+			double factor;
+
+			scale_component_op(rgb_index component_to_scale, double scale_factor)
+				: component(component_to_scale), factor(scale_factor) {
+				assert(is_rgb_index(component_to_scale));
+				assert(scale_factor >= 0.0);
+			}
+
+			void operator()(gfx::hdr_rgb& pixel) const {
+				float scaled=pixel[component]*factor;
+				pixel[component]=std::min(scaled, 1.0f);
+			}
+		};
+
+		// The per-pixel step of apply_lut.
+		template <typename color_depth>
+		struct lut_op {
+			static const bool WORKS_IN_HDR = false;
+			rgb_index component;
+			lookup_table<color_depth> table;
+
+			lut_op(rgb_index component, const lookup_table<color_depth>& table)
+				: component(component), table(table) {
+				assert(is_rgb_index(component));
+			}
+
+			void operator()(gfx::rgb<color_depth>& pixel) const {
+				pixel[component]=table[pixel[component]];
+			}
+		};
+
+		// The per-pixel step of grayscale.
+		struct grayscale_op {
+			static const bool WORKS_IN_HDR = false;
+			luminance_weights weights;
+
+			explicit grayscale_op(luminance_weights weights = LUMINANCE_DEFAULT)
+				: weights(weights) { }
+
+			template <typename color_depth>
+			void operator()(gfx::rgb<color_depth>& pixel) const {
+				typename color_depth::component_type gray=luminance(pixel, weights);
+				pixel.assign(gray,gray,gray);
+			}
+		};
+
+		// A point operation made from a function object f, such as a
+		// lambda, that takes a gfx::rgb& of the image's color depth, or an
+		// hdr_rgb& when WORKS_IN_HDR. Make one with pixel_op or hdr_pixel_op.
+		template <bool HDR, typename function>
+		struct custom_pixel_op {
+			static const bool WORKS_IN_HDR = HDR;
+			function f;
+
+			template <typename pixel_type>
+			void operator()(pixel_type& pixel) const {
+				f(pixel);
+			}
+		};
+
+		template <typename function>
+		custom_pixel_op<false, function> pixel_op(function f) {
+			return custom_pixel_op<false, function>{f};
+		}
+
+		template <typename function>
+		custom_pixel_op<true, function> hdr_pixel_op(function f) {
+			return custom_pixel_op<true, function>{f};
+		}
+
+		// The form of operation op that a pixel_pipeline runs on images of
+		// color_depth. Usually that is op itself, but for 8-bit color
+		// depths a scale_component_op becomes a lut_op, as in
+		// scale_component.
+		template <typename color_depth, typename op, typename enable = void>
+		struct pixel_op_for {
+			using type = op;
+			static const op& make(const op& o) { return o; }
+		};
+
+		template <typename color_depth>
+		struct pixel_op_for<color_depth, scale_component_op,
+				    typename std::enable_if<has_8_bit_components<color_depth>::value>::type> {
+			using type = lut_op<color_depth>;
+			static type make(const scale_component_op& o) {
+				return type(o.component, scale_component_table<color_depth>(o.factor));
+			}
+		};
+
+		// The operations of a pixel_pipeline, as a list built at compile
+		// time. run_native applies them to a pixel held in its own color
+		// depth, and run_hdr to one currently held as hdr_pixel; either way
+		// the result is left in pixel. The pixel only changes color depth
+		// where an operation works in a different one than the last.
+		template <typename... ops>
+		struct pixel_op_list;
+
+		template <>
+		struct pixel_op_list<> {
+			template <typename next>
+			pixel_op_list<next> then(const next& op) const {
+				return pixel_op_list<next>(op, *this);
+			}
+
+			template <typename color_depth>
+			pixel_op_list for_color_depth() const {
+				return *this;
+			}
+
+			template <typename color_depth>
+			void run_native(gfx::rgb<color_depth>&) const { }
+
+			template <typename color_depth>
+			void run_hdr(gfx::rgb<color_depth>& pixel, const gfx::hdr_rgb& hdr_pixel) const {
+				pixel=hdr_pixel.convert_to<color_depth>();
+			}
+		};
+
+		template <typename first, typename... rest>
+		struct pixel_op_list<first, rest...> {
+			first op;
+			pixel_op_list<rest...> others;
+
+			pixel_op_list(const first& op, const pixel_op_list<rest...>& others)
+				: op(op), others(others) { }
+
+			template <typename next>
+			pixel_op_list<first, rest..., next> then(const next& next_op) const {
+				return pixel_op_list<first, rest..., next>(op, others.then(next_op));
+			}
+
+			// Return the list with each operation in the form it takes
+			// for color_depth (see pixel_op_for).
+			template <typename color_depth>
+			pixel_op_list<typename pixel_op_for<color_depth, first>::type,
+				      typename pixel_op_for<color_depth, rest>::type...> for_color_depth() const {
+				return {pixel_op_for<color_depth, first>::make(op), others.template for_color_depth<color_depth>()};
+			}
+
+			template <typename color_depth>
+			void run_native(gfx::rgb<color_depth>& pixel) const {
+				run_native(std::integral_constant<bool, first::WORKS_IN_HDR>(), pixel);
+			}
+
+			template <typename color_depth>
+			void run_hdr(gfx::rgb<color_depth>& pixel, gfx::hdr_rgb& hdr_pixel) const {
+				run_hdr(std::integral_constant<bool, first::WORKS_IN_HDR>(), pixel, hdr_pixel);
+			}
+
+		private:
+			template <typename color_depth>
+			void run_native(std::false_type, gfx::rgb<color_depth>& pixel) const {
+				op(pixel);
+				others.run_native(pixel);
+			}
+			template <typename color_depth>
+			void run_native(std::true_type, gfx::rgb<color_depth>& pixel) const {
+				gfx::hdr_rgb hdr_pixel=pixel.template convert_to<hdr_color_depth>();
+				op(hdr_pixel);
+				others.run_hdr(pixel, hdr_pixel);
+			}
+			template <typename color_depth>
+			void run_hdr(std::false_type, gfx::rgb<color_depth>& pixel, gfx::hdr_rgb& hdr_pixel) const {
+				pixel=hdr_pixel.convert_to<color_depth>();
+				op(pixel);
+				others.run_native(pixel);
+			}
+			template <typename color_depth>
+			void run_hdr(std::true_type, gfx::rgb<color_depth>& pixel, gfx::hdr_rgb& hdr_pixel) const {
+				op(hdr_pixel);
+				others.run_hdr(pixel, hdr_pixel);
+			}
+		};
+
+		// A chain of point operations that runs in a single pass over the
+		// image. Build one by appending operations with then(...), starting
+		// from an empty pipeline:
+		//
+		//     auto correct = gfx::pixel_pipeline<>()
+		//       .then(gfx::scale_component_op(gfx::RGB_INDEX_RED, 1.1))
+		//       .then(gfx::scale_component_op(gfx::RGB_INDEX_BLUE, .9))
+		//       .then(gfx::clear_component_op(gfx::RGB_INDEX_GREEN))
+		//       .then(gfx::grayscale_op());
+		//     correct.apply(after, before);
+		//
+		// The operations are template arguments, so each pixel goes
+		// through all of them with no intermediate images and no indirect
+		// calls. A pixel is converted to hdr_rgb only when an operation
+		// that works in HDR follows one that does not, and back only when
+		// the reverse happens or at the end, so a run of HDR operations
+		// shares one pair of conversions. For an
+		// operation list that alternates, the result equals running the
+		// filters one after another; within a run of HDR operations the
+		// pixel is not rounded to the image's color depth in between, so
+		// the result may differ from separate filters by that rounding.
+		// On images with 8-bit components, apply looks each
+		// scale_component_op up in a table in the image's own color depth,
+		// as scale_component does, so it does not join a run of HDR
+		// operations.
+		template <typename... ops>
+		class pixel_pipeline {
+		public:
+			pixel_pipeline() { }
+
+			explicit pixel_pipeline(const pixel_op_list<ops...>& list)
+				: _ops(list) { }
+
+			// Return this pipeline followed by op.
+			template <typename next>
+			pixel_pipeline<ops..., next> then(const next& op) const {
+				return pixel_pipeline<ops..., next>(_ops.then(op));
+			}
+
+			// Apply the operations to pixel, in place.
+			template <typename color_depth>
+			void operator()(gfx::rgb<color_depth>& pixel) const {
+				_ops.run_native(pixel);
+			}
+
+			// Make after a copy of before with the operations applied to
+			// every pixel. before must be non-empty. The pixels are
+			// processed in tiles according to policy (see
+			// gfx::execution_policy).
+			template <typename color_depth>
+			void apply(const execution_policy& policy,
+				   gfx::image<color_depth>& after,
+				   const gfx::input_view<color_depth>& before) const {
+
+				// Check arguments.
+				assert(!before.empty());
+
+				after.same_size(before);
+				const auto depth_ops=_ops.template for_color_depth<color_depth>();
+				for_each_tile(policy, before.width(), before.height(), [&](const tile& t){
+
+					//a local copy, so the compiler can see that writing to after does not change the operations
+					const auto tile_ops=depth_ops;
+					for(int y=t.top;y<t.top+t.height;y++){
+						const gfx::rgb<color_depth>* source=before.row(y)+t.left;
+						gfx::rgb<color_depth>* destination=after.row(y)+t.left;
+						for(int x=0;x<t.width;x++){
+							gfx::rgb<color_depth> pixel=source[x];
+							tile_ops.run_native(pixel);
+							destination[x]=pixel;
+						}
+					}
+				});
+			}
+
+			// Apply the operations on the calling thread.
+			template <typename color_depth>
+			void apply(gfx::image<color_depth>& after,
+				   const gfx::input_view<color_depth>& before) const {
+				apply(sequential(), after, before);
+			}
+
+			// Apply the operations, returning the result by value. before
+			// may be an image or an image_view.
+			template <typename input_type>
+			gfx::image<typename input_type::color_depth> apply(const input_type& before) const {
+				gfx::image<typename input_type::color_depth> after;
+				apply(after, before);
+				return after;
+			}
+
+		private:
+			pixel_op_list<ops...> _ops;
+		};
+
+		// Edge detection with a compile-time border policy. Specifically,
+		// convert "before" to grayscale, apply the Sobel edge detection
+		// convolution filter, and store the gradient magnitude in
+		// "after". Pixels past the edges of before are resolved by
+		// BORDER; border_color is only used by BORDER_CONSTANT. before
+		// must be non-empty.
+		//
+		// This is a single pass over before. Luminance is computed on the
+		// fly into a rolling buffer of three rows, each padded by one
+		// border pixel on either side, and the gradient magnitude is
+		// written straight to after, so no intermediate images are made.
+		// The rows are processed according to policy (see
+		// gfx::execution_policy); each band of rows has its own buffer,
+		// primed with the two rows above the band.
+		template <border_policy BORDER, typename color_depth>
+		void edge_detect_with_border(const execution_policy& policy,
+					     gfx::image<color_depth>& after,
+					     const gfx::input_view<color_depth>& before,
+					     const gfx::rgb<color_depth>& border_color = BLACK.convert_to<color_depth>()) {
 
 			// Check arguments.
 			assert(!before.empty());
 
-			after=before;
-			for(int i=0;i<after.height();i++)//for every pixel
-				for(int j=0;j<after.width();j++){
-					int gray=(after.pixel(j,i).red()*0.2+after.pixel(j,i).green()*0.7+after.pixel(j,i).blue()*0.1);//find the sum of the values times multipliers from slids
-					after.pixel(j,i).red()=gray;//assign to every color value
-					after.pixel(j,i).green()=gray;
-					after.pixel(j,i).blue()=gray;
+			using component_type = typename color_depth::component_type;
+			using accumulator_type = typename color_depth::accumulator_type;
+
+			const int width=before.width(), height=before.height();
+			const component_type border_gray=luminance(border_color);
+
+			//fill row with the luminance of source row y, which may be out of range
+			auto load_row=[&](component_type* row, int y){
+				int source_y=border_index<BORDER>(y,height);
+				if(source_y<0){
+					std::fill(row, row+width+2, border_gray);
+					return;
+				}
+				const gfx::rgb<color_depth>* source=before.row(source_y);
+				for(int x=0;x<width;x++)
+					row[x+1]=luminance(source[x]);
+				int left=border_index<BORDER>(-1,width), right=border_index<BORDER>(width,width);
+				row[0]=(left<0) ? border_gray : row[left+1];
+				row[width+1]=(right<0) ? border_gray : row[right+1];
+			};
+
+			after.same_size(before);
+			for_each_band(policy, height, DEFAULT_BAND_HEIGHT, [&](int y_begin, int y_end){
+
+				//three padded luminance rows; rows[k][x+1] is the luminance at x
+				std::vector<component_type> storage(3*(std::size_t(width)+2));
+				component_type* rows[3]={&storage[0], &storage[width+2], &storage[2*(width+2)]};
+
+				load_row(rows[0],y_begin-1);
+				load_row(rows[1],y_begin);
+
+				for(int y=y_begin;y<y_end;y++){
+
+					//roll the window down: the oldest row is reused for row y+1
+					if(y>y_begin)
+						std::rotate(rows, rows+1, rows+3);
+					load_row(rows[2],y+1);
+
+					gfx::rgb<color_depth>* destination=after.row(y);
+					for(int x=0;x<width;x++){
+						const component_type *top=rows[0]+x, *middle=rows[1]+x, *bottom=rows[2]+x;
+
+						//Sobel gradients; the vertical kernel is the transpose of the horizontal one
+						accumulator_type gx=(accumulator_type(top[2])-top[0])
+							+2*(accumulator_type(middle[2])-middle[0])
+							+(accumulator_type(bottom[2])-bottom[0]);
+						accumulator_type gy=(accumulator_type(bottom[0])-top[0])
+							+2*(accumulator_type(bottom[1])-top[1])
+							+(accumulator_type(bottom[2])-top[2]);
+
+						//assign the clamped gradient magnitude to every component
+						double magnitude=sqrt(double(gx)*gx+double(gy)*gy);
+						if(magnitude>color_depth::max_value_double)
+							magnitude=color_depth::max_value_double;
+						component_type value=static_cast<component_type>(magnitude);
+						destination[x].assign(value,value,value);
+					}
 				}
+			});
+		}
+
+		// Edge detection with a compile-time border policy, on the calling
+		// thread.
+		template <border_policy BORDER, typename color_depth>
+		void edge_detect_with_border(gfx::image<color_depth>& after,
+					     const gfx::input_view<color_depth>& before,
+					     const gfx::rgb<color_depth>& border_color = BLACK.convert_to<color_depth>()) {
+			edge_detect_with_border<BORDER>(sequential(), after, before, border_color);
 		}
 
 		// Edge detection. Specifically, convert "before" to grayscale,
 		// apply the Sobel edge detection convolution filter, and store the
-		// result in "after". before must be non-empty.
+		// result in "after". Pixels past the edges of before are read
+		// according to border (see gfx::border_policy). before must be
+		// non-empty. The rows are processed according to policy (see
+		// gfx::execution_policy).
+		template <typename color_depth>
+		void edge_detect(const execution_policy& policy,
+				 gfx::image<color_depth>& after,
+				 const gfx::input_view<color_depth>& before,
+				 border_policy border = BORDER_CLAMP,
+				 const gfx::rgb<color_depth>& border_color = BLACK.convert_to<color_depth>()) {
+			switch(border){
+			case BORDER_CLAMP:    edge_detect_with_border<BORDER_CLAMP>(policy, after, before, border_color); break;
+			case BORDER_MIRROR:   edge_detect_with_border<BORDER_MIRROR>(policy, after, before, border_color); break;
+			case BORDER_WRAP:     edge_detect_with_border<BORDER_WRAP>(policy, after, before, border_color); break;
+			case BORDER_CONSTANT: edge_detect_with_border<BORDER_CONSTANT>(policy, after, before, border_color); break;
+			}
+		}
+
+		// Edge detection on the calling thread.
 		template <typename color_depth>
 		void edge_detect(gfx::image<color_depth>& after,
-				 const gfx::image<color_depth>& before) {
+				 const gfx::input_view<color_depth>& before,
+				 border_policy border = BORDER_CLAMP,
+				 const gfx::rgb<color_depth>& border_color = BLACK.convert_to<color_depth>()) {
+			edge_detect(sequential(), after, before, border, border_color);
+		}
+
+		// Edge detection, returning the result by value. before may be an
+		// image or an image_view.
+		template <typename input_type>
+		gfx::image<typename input_type::color_depth> edge_detect(const input_type& before,
+								   border_policy border = BORDER_CLAMP) {
+			gfx::image<typename input_type::color_depth> after;
+			edge_detect(after, before, border);
+			return after;
+		}
+
+		// Box blur with a compile-time border policy. Use the box
+		// convolution filter, with the given radius, to achieve a blur
+		// effect. Each output pixel is the average of the (2*radius+1) x
+		// (2*radius+1) window centered on it, where pixels outside before
+		// are resolved by BORDER; border_color is only used by
+		// BORDER_CONSTANT. before must be non-empty and radius must be
+		// positive.
+		//
+		// The box kernel is separable, so this runs a vertical pass and a
+		// horizontal pass, each keeping a running sum of the window that is
+		// updated by adding the entering pixel and subtracting the leaving
+		// one. That makes the cost per pixel constant regardless of radius,
+		// and only one row of column sums is kept in memory.
+		//
+		// On the calling thread the whole image is one strip. In parallel
+		// (see gfx::execution_policy) it is split into strips of whole
+		// columns, each keeping the column sums of its own columns and of
+		// radius more on either side, which its horizontal pass reads.
+		// Strips are at least DEFAULT_STRIP_WIDTH columns and a multiple
+		// of four windows wide, so those extra columns stay under a
+		// quarter of the work. The horizontal pass starts its running sum
+		// afresh at every strip boundary, also on the calling thread, so
+		// both give identical results.
+		template <border_policy BORDER, typename color_depth>
+		void box_blur_with_border(const execution_policy& policy,
+					  gfx::image<color_depth>& after,
+					  const gfx::input_view<color_depth>& before,
+					  int radius,
+					  const gfx::rgb<color_depth>& border_color = BLACK.convert_to<color_depth>()) {
 
 			// Check arguments.
 			assert(!before.empty());
+			assert(radius > 0);
 
-	        grayscale(after, before);
-	        extend_edges(after, before, 1);
-	        
-	        int sobel[3][3]={
-	        	{-1,0,1},
-	        	{-2,0,2},
-	        	{-1,0,1}
-	        };
+			using accumulator_type = typename color_depth::accumulator_type;
+			using component_type = typename color_depth::component_type;
+
+			const int width=before.width(), height=before.height();
+			const accumulator_type area=accumulator_type(2*radius+1)*(2*radius+1);
+
+			//a column entirely outside before (only possible with BORDER_CONSTANT) sums to this
+			accumulator_type border_column[3];
+			for(int i=0;i<3;i++)
+				border_column[i]=accumulator_type(2*radius+1)*accumulator_type(border_color[i]);
+
+			//strip width: a multiple of the window, at least four windows and DEFAULT_STRIP_WIDTH
+			const int window=2*radius+1,
+				strip_width=window*std::max(4, (DEFAULT_STRIP_WIDTH+window-1)/window);
+
+			after.same_size(before);
+			for_each_tile(policy, width, height, policy.is_parallel() ? strip_width : width, height, [&](const tile& strip){
 
-	        for(int x=0;x<after.width();x++)//for every pixel
-	          for(int y=0;y<after.height();y++) {
-	  			float pixels[3][3];
+				//the strip's window covers columns [first, first+count) of the image extended by BORDER,
+				//and sources[j] is the column of before that column first+j reads, or negative for the border color
+				const int first=strip.left-radius, count=strip.width+2*radius;
+				std::vector<int> sources(count);
+				for(int j=0;j<count;j++)
+					sources[j]=border_index<BORDER>(first+j,width);
 
-	  			//find gradient by multiplying corresponding spot with sobel operator, then sum every number in matrix
-	            int sum=0;
-	            for(int i=0;i<3;i++)
-	              for(int j=0;j<3;j++)
-	              	sum+=pixels[i][j]*sobel[i][j];
-	            
-	            //assign the gradient to pixel
-	            for(int i=0;i<3;i++)
-	                after.pixel(x, y)[i] = sum;
-	            }
+				//columns [inner_begin, inner_end) lie inside before, so column first+j reads itself
+				const int inner_begin=std::min(count,std::max(0,-first)),
+					inner_end=std::max(inner_begin,std::min(count,width-first));
 
-	        gfx::image<color_depth> copy=after;
-			crop_extended_edges(after,copy,1);
+				//vertical pass state: columns[3*j+i] is the sum of component i over the window's rows in column first+j
+				std::vector<accumulator_type> columns(3*std::size_t(count), 0);
+				auto add_row=[&](int y, int sign){
+					int source_y=border_index<BORDER>(y,height);
+					if(source_y<0){
+						//a row of the constant border color
+						for(int j=0;j<count;j++)
+							for(int i=0;i<3;i++)
+								columns[3*j+i]+=sign*accumulator_type(border_color[i]);
+						return;
+					}
+					const gfx::rgb<color_depth>* source=before.row(source_y);
+					auto add_outer=[&](int j_begin, int j_end){
+						for(int j=j_begin;j<j_end;j++)
+							if(sources[j]>=0)
+								for(int i=0;i<3;i++)
+									columns[3*j+i]+=sign*accumulator_type(source[sources[j]][i]);
+					};
+					add_outer(0,inner_begin);
+					//through local pointers, so the compiler can see that the sums do not overlap the row, and vectorize
+					accumulator_type* sums=&columns[3*std::size_t(inner_begin)];
+					const gfx::rgb<color_depth>* inner=source+(first+inner_begin);
+					for(int k=0, n=inner_end-inner_begin;k<n;k++)
+						for(int i=0;i<3;i++)
+							sums[3*k+i]+=sign*accumulator_type(inner[k][i]);
+					add_outer(inner_end,count);
+				};
+				auto column=[&](int j, int i){
+					return ((BORDER==BORDER_CONSTANT) && (sources[j]<0)) ? border_column[i] : columns[3*j+i];
+				};
 
+				//prime the window for the first row
+				for(int y=-radius;y<=radius;y++)
+					add_row(y,1);
+
+				for(int y=0;y<height;y++){
+
+					//slide the vertical window down one row
+					if(y>0){
+						add_row(y+radius,1);
+						add_row(y-radius-1,-1);
+					}
+
+					//horizontal pass over the column sums, sliding the window right one pixel at a time,
+					//and summing it afresh at every strip boundary
+					accumulator_type sum[3]={0,0,0};
+					gfx::rgb<color_depth>* destination=after.row(y)+strip.left;
+					for(int x=0, boundary=0;x<strip.width;x++){
+						if(x==boundary){
+							boundary+=strip_width;
+							for(int i=0;i<3;i++){
+								sum[i]=0;
+								for(int j=x;j<=x+2*radius;j++)
+									sum[i]+=column(j,i);
+							}
+						} else
+							for(int i=0;i<3;i++)
+								sum[i]+=column(x+2*radius,i)-column(x-1,i);
+						for(int i=0;i<3;i++)
+							destination[x][i]=static_cast<component_type>(sum[i]/area);
+					}
+				}
+			});
+		}
+
+		// Box blur with a compile-time border policy, on the calling
+		// thread.
+		template <border_policy BORDER, typename color_depth>
+		void box_blur_with_border(gfx::image<color_depth>& after,
+					  const gfx::input_view<color_depth>& before,
+					  int radius,
+					  const gfx::rgb<color_depth>& border_color = BLACK.convert_to<color_depth>()) {
+			box_blur_with_border<BORDER>(sequential(), after, before, radius, border_color);
 		}
 
 		// Box blur. Use the box convolution filter, with the given radius,
-		// to achieve a blur effect. before must be non-empty and radius
-		// must be positive.
+		// to achieve a blur effect. Pixels past the edges of before are
+		// read according to border (see gfx::border_policy); the default
+		// repeats the edge pixels, as extend_edges does. before must be
+		// non-empty and radius must be positive. The columns are processed
+		// in strips according to policy (see gfx::execution_policy).
+		template <typename color_depth>
+		void box_blur(const execution_policy& policy,
+			gfx::image<color_depth>& after,
+			const gfx::input_view<color_depth>& before,
+			int radius,
+			border_policy border = BORDER_CLAMP,
+			const gfx::rgb<color_depth>& border_color = BLACK.convert_to<color_depth>()) {
+			switch(border){
+			case BORDER_CLAMP:    box_blur_with_border<BORDER_CLAMP>(policy, after, before, radius, border_color); break;
+			case BORDER_MIRROR:   box_blur_with_border<BORDER_MIRROR>(policy, after, before, radius, border_color); break;
+			case BORDER_WRAP:     box_blur_with_border<BORDER_WRAP>(policy, after, before, radius, border_color); break;
+			case BORDER_CONSTANT: box_blur_with_border<BORDER_CONSTANT>(policy, after, before, radius, border_color); break;
+			}
+		}
+
+		// Box blur on the calling thread.
 		template <typename color_depth>
 		void box_blur(gfx::image<color_depth>& after,
-			const gfx::image<color_depth>& before,
-			int radius) {
+			const gfx::input_view<color_depth>& before,
+			int radius,
+			border_policy border = BORDER_CLAMP,
+			const gfx::rgb<color_depth>& border_color = BLACK.convert_to<color_depth>()) {
+			box_blur(sequential(), after, before, radius, border, border_color);
+		}
+
+		// Box blur, returning the result by value. before may be an image
+		// or an image_view.
+		template <typename input_type>
+		gfx::image<typename input_type::color_depth> box_blur(const input_type& before,
+								int radius,
+								border_policy border = BORDER_CLAMP) {
+			gfx::image<typename input_type::color_depth> after;
+			box_blur(after, before, radius, border);
+			return after;
+		}
+
+		// Arithmetic used by convolve for a given color depth. Integral
+		// color depths use fixed-point weights with FRACTION_BITS
+		// fractional bits and 64-bit integer sums, so integer kernels are
+		// exact and no floating point is used in the inner loop. Other
+		// color depths use float weights and sums.
+		template <typename color_depth,
+			  bool INTEGRAL = std::is_integral<typename color_depth::component_type>::value>
+		struct convolution_arithmetic;
+
+		template <typename color_depth>
+		struct convolution_arithmetic<color_depth, true> {
+			using weight_type = int64_t;
+			using sum_type = int64_t;
+			static const int FRACTION_BITS = 16;
+
+			static weight_type weight(float w) {
+				return llround(double(w)*(int64_t(1)<<FRACTION_BITS));
+			}
+
+			//round to nearest and clamp into [0, max_value]; a separable sum is the product of two weights so has twice the fraction bits
+			static typename color_depth::component_type result(sum_type sum, int fraction_bits=FRACTION_BITS) {
+				if(sum<=0)
+					return 0;
+				sum=(sum+(int64_t(1)<<(fraction_bits-1)))>>fraction_bits;
+				return (sum>color_depth::max_value_int) ? color_depth::max_value_int : sum;
+			}
+			static typename color_depth::component_type separable_result(sum_type sum) {
+				return result(sum, 2*FRACTION_BITS);
+			}
+
+			//true when the fixed-point factors multiply back to exactly the fixed-point kernel, so the separable path gives identical results
+			template <int KW, int KH>
+			static bool exactly_separable(const gfx::matrix<float, KH, KW>& kernel,
+						      const gfx::vector<float, KW>& row_kernel,
+						      const gfx::vector<float, KH>& column_kernel) {
+				for(int i=0;i<KH;i++)
+					for(int j=0;j<KW;j++)
+						if(weight(column_kernel[i])*weight(row_kernel[j])!=weight(kernel[i][j])*(int64_t(1)<<FRACTION_BITS))
+							return false;
+				return true;
+			}
+		};
+
+		template <typename color_depth>
+		struct convolution_arithmetic<color_depth, false> {
+			using weight_type = float;
+			using sum_type = float;
+
+			static weight_type weight(float w) {
+				return w;
+			}
+
+			//clamp into [0, max_value]
+			static typename color_depth::component_type result(sum_type sum) {
+				return color_depth::clamp(sum);
+			}
+			static typename color_depth::component_type separable_result(sum_type sum) {
+				return color_depth::clamp(sum);
+			}
+
+			//floating-point results only need to agree up to rounding
+			template <int KW, int KH>
+			static bool exactly_separable(const gfx::matrix<float, KH, KW>&,
+						      const gfx::vector<float, KW>&,
+						      const gfx::vector<float, KH>&) {
+				return true;
+			}
+		};
+
+		// Determine whether kernel is separable, i.e. the outer product of
+		// a column vector and a row vector, so that
+		//
+		//     kernel[i][j] == column_kernel[i] * row_kernel[j]
+		//
+		// for every i and j, up to float rounding. If so, store the factors
+		// in row_kernel and column_kernel and return true. Otherwise return
+		// false and leave them unspecified. An all-zero kernel is reported
+		// as not separable.
+		template <int KW, int KH>
+		bool separate_kernel(const gfx::matrix<float, KH, KW>& kernel,
+				     gfx::vector<float, KW>& row_kernel,
+				     gfx::vector<float, KH>& column_kernel) {
+
+			//the largest-magnitude element is the most accurate pivot
+			int pivot_i=0, pivot_j=0;
+			for(int i=0;i<KH;i++)
+				for(int j=0;j<KW;j++)
+					if(fabs(kernel[i][j])>fabs(kernel[pivot_i][pivot_j])){
+						pivot_i=i;
+						pivot_j=j;
+					}
+			float pivot=kernel[pivot_i][pivot_j];
+			if(pivot==0)
+				return false;
+
+			//a rank-1 kernel is its pivot column times its pivot row, scaled by the pivot
+			for(int i=0;i<KH;i++)
+				column_kernel[i]=kernel[i][pivot_j];
+			for(int j=0;j<KW;j++)
+				row_kernel[j]=kernel[pivot_i][j]/pivot;
+
+			const double tolerance=1e-6*fabs(pivot);
+			for(int i=0;i<KH;i++)
+				for(int j=0;j<KW;j++)
+					if(fabs(double(column_kernel[i])*row_kernel[j]-kernel[i][j])>tolerance)
+						return false;
+			return true;
+		}
+
+		// Separable convolution with a compile-time border policy. after is
+		// filled with before convolved with the KH x KW kernel whose
+		// elements are column_kernel[i] * row_kernel[j], anchored at (KW/2,
+		// KH/2), with the same clamping and border handling as
+		// convolve_with_border. before must be non-empty.
+		//
+		// This costs O(KW + KH) per pixel rather than O(KW * KH). Each
+		// output row is made by a vertical 1-D pass over the KH source rows
+		// into a single row of intermediate sums, followed by a horizontal
+		// 1-D pass over that row, so the intermediate stays in cache. The
+		// rows are processed according to policy (see
+		// gfx::execution_policy).
+		template <border_policy BORDER, int KW, int KH, typename color_depth>
+		void convolve_separable_with_border(const execution_policy& policy,
+						    gfx::image<color_depth>& after,
+						    const gfx::input_view<color_depth>& before,
+						    const gfx::vector<float, KW>& row_kernel,
+						    const gfx::vector<float, KH>& column_kernel,
+						    const gfx::rgb<color_depth>& border_color = BLACK.convert_to<color_depth>()) {
+
+			static_assert(KW > 0, "kernel width must be positive");
+			static_assert(KH > 0, "kernel height must be positive");
 
 			// Check arguments.
 			assert(!before.empty());
-			assert(radius > 0);
 
-	        after.same_size(before);
+			using arithmetic = convolution_arithmetic<color_depth>;
+			using weight_type = typename arithmetic::weight_type;
+			using sum_type = typename arithmetic::sum_type;
+			using rgb_type = gfx::rgb<color_depth>;
+
+			const int width=before.width(), height=before.height();
+			const int anchor_x=KW/2, anchor_y=KH/2;
+
+			//output x-coordinates whose whole horizontal window is inside before
+			const int interior_begin=std::min(anchor_x,width),
+				interior_end=std::max(interior_begin,width-(KW-1-anchor_x));
+
+			after.same_size(before);
+			for_each_band(policy, height, DEFAULT_BAND_HEIGHT, [&](int y_begin, int y_end){
+
+				//local to the band, so the compiler can see that writing to columns and after does not change them
+				weight_type row_weights[KW], column_weights[KH];
+				for(int j=0;j<KW;j++)
+					row_weights[j]=arithmetic::weight(row_kernel[j]);
+				for(int i=0;i<KH;i++)
+					column_weights[i]=arithmetic::weight(column_kernel[i]);
+
+				//vertical pass of a column made entirely of border pixels
+				sum_type border_column[3]={0,0,0};
+				for(int i=0;i<KH;i++)
+					for(int c=0;c<3;c++)
+						border_column[c]+=column_weights[i]*border_color[c];
+
+				//columns[3*x+c] is the vertical pass for component c of column x of the current row
+				std::vector<sum_type> columns(3*std::size_t(width));
+				auto column=[&](int sx, int c){
+					int source_x=border_index<BORDER>(sx,width);
+					return (source_x<0) ? border_column[c] : columns[3*source_x+c];
+				};
+
+				for(int y=y_begin;y<y_end;y++){
 
-	        for(int x=0;x<after.width();x++)//for every pixel...
-	          for (int y=0;y<after.height();y++){
+					//vertical pass
+					std::fill(columns.begin(), columns.end(), sum_type(0));
+					for(int i=0;i<KH;i++){
+						int source_y=border_index<BORDER>(y+i-anchor_y,height);
+						if(source_y<0){
+							for(int x=0;x<width;x++)
+								for(int c=0;c<3;c++)
+									columns[3*x+c]+=column_weights[i]*border_color[c];
+							continue;
+						}
+						const rgb_type* source=before.row(source_y);
+						for(int x=0;x<width;x++)
+							for(int c=0;c<3;c++)
+								columns[3*x+c]+=column_weights[i]*source[x][c];
+					}
 
-	            //calculate average
-	            float sum=0;
-	            for(int i=0;i<3;i++)
-	            	sum+=after.pixel(x,y)[i]+after.pixel(x,y)[i]+after.pixel(x,y)[i];
-	            float avg=sum/9;
+					//horizontal pass
+					rgb_type* destination=after.row(y);
+					auto convolve_pixel=[&](int x, bool interior){
+						sum_type sum[3]={0,0,0};
+						for(int j=0;j<KW;j++)
+							for(int c=0;c<3;c++)
+								sum[c]+=row_weights[j]*(interior ? columns[3*(x+j-anchor_x)+c] : column(x+j-anchor_x,c));
+						for(int c=0;c<3;c++)
+							destination[x][c]=arithmetic::separable_result(sum[c]);
+					};
+
+					for(int x=0;x<interior_begin;x++)
+						convolve_pixel(x,false);
+					for(int x=interior_begin;x<interior_end;x++)
+						convolve_pixel(x,true);
+					for(int x=interior_end;x<width;x++)
+						convolve_pixel(x,false);
+				}
+			});
+		}
+
+		// Separable convolution with a compile-time border policy, on the
+		// calling thread.
+		template <border_policy BORDER, int KW, int KH, typename color_depth>
+		void convolve_separable_with_border(gfx::image<color_depth>& after,
+						    const gfx::input_view<color_depth>& before,
+						    const gfx::vector<float, KW>& row_kernel,
+						    const gfx::vector<float, KH>& column_kernel,
+						    const gfx::rgb<color_depth>& border_color = BLACK.convert_to<color_depth>()) {
+			convolve_separable_with_border<BORDER>(sequential(), after, before, row_kernel, column_kernel, border_color);
+		}
+
+		// Separable convolution. after is filled with before convolved with
+		// the outer product of column_kernel and row_kernel; see
+		// convolve_separable_with_border for details. Pixels past the edges
+		// of before are read according to border (see
+		// gfx::border_policy). before must be non-empty. The rows are
+		// processed according to policy (see gfx::execution_policy).
+		template <int KW, int KH, typename color_depth>
+		void convolve_separable(const execution_policy& policy,
+					gfx::image<color_depth>& after,
+					const gfx::input_view<color_depth>& before,
+					const gfx::vector<float, KW>& row_kernel,
+					const gfx::vector<float, KH>& column_kernel,
+					border_policy border = BORDER_CLAMP,
+					const gfx::rgb<color_depth>& border_color = BLACK.convert_to<color_depth>()) {
+			switch(border){
+			case BORDER_CLAMP:    convolve_separable_with_border<BORDER_CLAMP>(policy, after, before, row_kernel, column_kernel, border_color); break;
+			case BORDER_MIRROR:   convolve_separable_with_border<BORDER_MIRROR>(policy, after, before, row_kernel, column_kernel, border_color); break;
+			case BORDER_WRAP:     convolve_separable_with_border<BORDER_WRAP>(policy, after, before, row_kernel, column_kernel, border_color); break;
+			case BORDER_CONSTANT: convolve_separable_with_border<BORDER_CONSTANT>(policy, after, before, row_kernel, column_kernel, border_color); break;
+			}
+		}
+
+		// Separable convolution on the calling thread.
+		template <int KW, int KH, typename color_depth>
+		void convolve_separable(gfx::image<color_depth>& after,
+					const gfx::input_view<color_depth>& before,
+					const gfx::vector<float, KW>& row_kernel,
+					const gfx::vector<float, KH>& column_kernel,
+					border_policy border = BORDER_CLAMP,
+					const gfx::rgb<color_depth>& border_color = BLACK.convert_to<color_depth>()) {
+			convolve_separable(sequential(), after, before, row_kernel, column_kernel, border, border_color);
+		}
 
-	            //assign to all values of current pixel
-	            for(int i=0;i<3;i++)
-	            	after.pixel(x, y)[i]=avg;
-	           }
-    	}	
+		// Separable convolution, returning the result by value. before may
+		// be an image or an image_view.
+		template <int KW, int KH, typename input_type>
+		gfx::image<typename input_type::color_depth> convolve_separable(const input_type& before,
+									  const gfx::vector<float, KW>& row_kernel,
+									  const gfx::vector<float, KH>& column_kernel,
+									  border_policy border = BORDER_CLAMP) {
+			gfx::image<typename input_type::color_depth> after;
+			convolve_separable(after, before, row_kernel, column_kernel, border);
+			return after;
+		}
+
+		// Convolution with a compile-time border policy. after is filled
+		// with before convolved with kernel, a KH x KW matrix whose anchor
+		// (KW/2, KH/2) lies over the output pixel; as with edge_detect, the
+		// kernel is applied as written, without flipping. Each component is
+		// filtered independently, and results are clamped into [0,
+		// max_value]. Pixels past the edges of before are resolved by
+		// BORDER; border_color is only used by BORDER_CONSTANT. before must
+		// be non-empty.
+		//
+		// KW and KH are template parameters, so the loops over the kernel
+		// have constant trip counts and the compiler can unroll them. Output
+		// pixels whose window lies entirely inside before are computed
+		// without any border checks. The pixels are processed in tiles
+		// according to policy (see gfx::execution_policy).
+		template <border_policy BORDER, int KW, int KH, typename color_depth>
+		void convolve_with_border(const execution_policy& policy,
+					  gfx::image<color_depth>& after,
+					  const gfx::input_view<color_depth>& before,
+					  const gfx::matrix<float, KH, KW>& kernel,
+					  const gfx::rgb<color_depth>& border_color = BLACK.convert_to<color_depth>()) {
+
+			static_assert(KW > 0, "kernel width must be positive");
+			static_assert(KH > 0, "kernel height must be positive");
+
+			// Check arguments.
+			assert(!before.empty());
+
+			using arithmetic = convolution_arithmetic<color_depth>;
+			using weight_type = typename arithmetic::weight_type;
+			using sum_type = typename arithmetic::sum_type;
+			using rgb_type = gfx::rgb<color_depth>;
+
+			const int width=before.width(), height=before.height();
+			const int anchor_x=KW/2, anchor_y=KH/2;
+
+			//read column sx of row, which may be out of range; a null row is a row of border pixels
+			auto sample=[&](const rgb_type* row, int sx) -> const rgb_type& {
+				if(row==nullptr)
+					return border_color;
+				int source_x=border_index<BORDER>(sx,width);
+				return (source_x<0) ? border_color : row[source_x];
+			};
+
+			//output x-coordinates whose whole window is inside before
+			const int interior_begin=std::min(anchor_x,width),
+				interior_end=std::max(interior_begin,width-(KW-1-anchor_x));
+
+			after.same_size(before);
+			for_each_tile(policy, width, height, [&](const tile& t){
+
+				//local to the tile, so the compiler can see that writing to after does not change them
+				weight_type weights[KH][KW];
+				for(int i=0;i<KH;i++)
+					for(int j=0;j<KW;j++)
+						weights[i][j]=arithmetic::weight(kernel[i][j]);
+
+				const int left=t.left, right=t.left+t.width;
+				for(int y=t.top;y<t.top+t.height;y++){
+
+					//the KH source rows under the kernel
+					const rgb_type* rows[KH];
+					for(int i=0;i<KH;i++){
+						int source_y=border_index<BORDER>(y+i-anchor_y,height);
+						rows[i]=(source_y<0) ? nullptr : before.row(source_y);
+					}
+
+					rgb_type* destination=after.row(y);
+					auto convolve_pixel=[&](int x, bool interior){
+						sum_type sum[3]={0,0,0};
+						for(int i=0;i<KH;i++)
+							for(int j=0;j<KW;j++){
+								const rgb_type& pixel=(interior && (rows[i]!=nullptr))
+									? rows[i][x+j-anchor_x]
+									: sample(rows[i],x+j-anchor_x);
+								for(int c=0;c<3;c++)
+									sum[c]+=weights[i][j]*pixel[c];
+							}
+						for(int c=0;c<3;c++)
+							destination[x][c]=arithmetic::result(sum[c]);
+					};
+
+					for(int x=left;x<std::min(right,interior_begin);x++)
+						convolve_pixel(x,false);
+					for(int x=std::max(left,interior_begin);x<std::min(right,interior_end);x++)
+						convolve_pixel(x,true);
+					for(int x=std::max(left,interior_end);x<right;x++)
+						convolve_pixel(x,false);
+				}
+			});
+		}
+
+		// Convolution with a compile-time border policy, on the calling
+		// thread.
+		template <border_policy BORDER, int KW, int KH, typename color_depth>
+		void convolve_with_border(gfx::image<color_depth>& after,
+					  const gfx::input_view<color_depth>& before,
+					  const gfx::matrix<float, KH, KW>& kernel,
+					  const gfx::rgb<color_depth>& border_color = BLACK.convert_to<color_depth>()) {
+			convolve_with_border<BORDER>(sequential(), after, before, kernel, border_color);
+		}
+
+		// Convolution. after is filled with before convolved with kernel;
+		// see convolve_with_border for details. Pixels past the edges of
+		// before are read according to border (see gfx::border_policy).
+		// before must be non-empty.
+		//
+		// When kernel is separable (see separate_kernel), this takes the
+		// O(KW + KH) convolve_separable path instead. For integral color
+		// depths that only happens when the separable fixed-point
+		// arithmetic is exact, so the result is identical either way.
+		//
+		// The pixels are processed according to policy (see
+		// gfx::execution_policy), in tiles, or in bands of rows on the
+		// separable path.
+		template <int KW, int KH, typename color_depth>
+		void convolve(const execution_policy& policy,
+			      gfx::image<color_depth>& after,
+			      const gfx::input_view<color_depth>& before,
+			      const gfx::matrix<float, KH, KW>& kernel,
+			      border_policy border = BORDER_CLAMP,
+			      const gfx::rgb<color_depth>& border_color = BLACK.convert_to<color_depth>()) {
+			if((KW>1) && (KH>1)){
+				gfx::vector<float, KW> row_kernel;
+				gfx::vector<float, KH> column_kernel;
+				if(separate_kernel(kernel, row_kernel, column_kernel) &&
+				   convolution_arithmetic<color_depth>::exactly_separable(kernel, row_kernel, column_kernel)){
+					convolve_separable(policy, after, before, row_kernel, column_kernel, border, border_color);
+					return;
+				}
+			}
+			switch(border){
+			case BORDER_CLAMP:    convolve_with_border<BORDER_CLAMP>(policy, after, before, kernel, border_color); break;
+			case BORDER_MIRROR:   convolve_with_border<BORDER_MIRROR>(policy, after, before, kernel, border_color); break;
+			case BORDER_WRAP:     convolve_with_border<BORDER_WRAP>(policy, after, before, kernel, border_color); break;
+			case BORDER_CONSTANT: convolve_with_border<BORDER_CONSTANT>(policy, after, before, kernel, border_color); break;
+			}
+		}
+
+		// Convolution on the calling thread.
+		template <int KW, int KH, typename color_depth>
+		void convolve(gfx::image<color_depth>& after,
+			      const gfx::input_view<color_depth>& before,
+			      const gfx::matrix<float, KH, KW>& kernel,
+			      border_policy border = BORDER_CLAMP,
+			      const gfx::rgb<color_depth>& border_color = BLACK.convert_to<color_depth>()) {
+			convolve(sequential(), after, before, kernel, border, border_color);
+		}
+
+		// Convolution, returning the result by value. before may be an
+		// image or an image_view.
+		template <int KW, int KH, typename input_type>
+		gfx::image<typename input_type::color_depth> convolve(const input_type& before,
+								const gfx::matrix<float, KH, KW>& kernel,
+								border_policy border = BORDER_CLAMP) {
+			gfx::image<typename input_type::color_depth> after;
+			convolve(after, before, kernel, border);
+			return after;
+		}
+
+		// Commonly used 3x3 kernels, for use with convolve.
+
+		// Sharpen: boost each pixel against its four neighbors.
+		gfx::matrix3x3<float> sharpen_kernel() {
+			return gfx::matrix3x3<float>({ 0, -1,  0,
+						      -1,  5, -1,
+						       0, -1,  0});
+		}
+
+		// Emboss: a diagonal gradient that leaves flat regions unchanged.
+		gfx::matrix3x3<float> emboss_kernel() {
+			return gfx::matrix3x3<float>({-2, -1,  0,
+						      -1,  1,  1,
+						       0,  1,  2});
+		}
+
+		// Laplacian: second derivative, which is zero in flat regions.
+		gfx::matrix3x3<float> laplacian_kernel() {
+			return gfx::matrix3x3<float>({ 0,  1,  0,
+						       1, -4,  1,
+						       0,  1,  0});
+		}
 }
@@ -3,7 +3,20 @@
 //
 // Data structure for a raster image. The image<color_depth_type>
 // template class stores a raster image encoded in the specified color
-// depth.
+// depth. Pixels are stored in one contiguous, aligned buffer in
+// row-major order, so filters and I/O code can stream through them
+// linearly via the data() and row(y) functions.
+//
+// The image_view<color_depth_type> template class is a non-owning,
+// read-only window onto a rectangle of pixels that live somewhere
+// else, usually inside an image. Views are cheap to create and copy,
+// so cropping, tiling, and region-of-interest processing need not
+// copy any pixels.
+//
+// A border_policy decides what a filter sees when it reads
+// coordinates outside an image, and bordered_view applies a policy to
+// an image_view, so convolution filters can read past the edges
+// without first copying the image into a padded buffer.
 //
 // This module builds on gfxcolor.hh, so familiarize yourself with
 // that file before using this one.
@@ -14,13 +27,89 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
 #include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include "gfxcolor.hh"
 
 namespace gfx {
 
+  // Alignment, in bytes, of the first pixel of every image buffer. 64
+  // bytes is a cache line on all mainstream CPUs, and is also enough
+  // for any SIMD load.
+  const std::size_t PIXEL_ALIGNMENT = 64;
+
+  // A standard-library-compatible allocator that returns memory
+  // aligned to ALIGNMENT bytes. ALIGNMENT must be a power of two. This
+  // is used as the allocator of the std::vector that holds image
+  // pixels.
+  template <typename T, std::size_t ALIGNMENT>
+  class aligned_allocator {
+  public:
+
+    static_assert((ALIGNMENT & (ALIGNMENT - 1)) == 0,
+		  "alignment must be a power of two");
+    static_assert(ALIGNMENT >= sizeof(void*),
+		  "alignment must be able to hold a pointer");
+
+    // Type aliases required by std::allocator_traits. Since all
+    // aligned_allocator objects are interchangeable, moving a
+    // container may always steal its buffer.
+    using value_type = T;
+    using propagate_on_container_move_assignment = std::true_type;
+
+    template <typename U>
+    struct rebind {
+      using other = aligned_allocator<U, ALIGNMENT>;
+    };
+
+    aligned_allocator() { }
+
+    template <typename U>
+    aligned_allocator(const aligned_allocator<U, ALIGNMENT>&) { }
+
+    // Allocate room for n objects of type T. We over-allocate by
+    // ALIGNMENT bytes, round the address up to the next multiple of
+    // ALIGNMENT, and stash the original address just before the
+    // aligned block so that deallocate can find it.
+    T* allocate(std::size_t n) {
+      if (n > (std::numeric_limits<std::size_t>::max() - ALIGNMENT) / sizeof(T)) {
+	throw std::bad_alloc();
+      }
+      void* raw = ::operator new(n * sizeof(T) + ALIGNMENT);
+      std::uintptr_t address = reinterpret_cast<std::uintptr_t>(raw),
+	aligned = (address + ALIGNMENT) & ~(std::uintptr_t(ALIGNMENT) - 1);
+      reinterpret_cast<void**>(aligned)[-1] = raw;
+      return reinterpret_cast<T*>(aligned);
+    }
+
+    // Release memory obtained from allocate.
+    void deallocate(T* p, std::size_t) {
+      if (p != nullptr) {
+	::operator delete(reinterpret_cast<void**>(p)[-1]);
+      }
+    }
+
+    // All aligned_allocator objects are interchangeable.
+    template <typename U>
+    bool operator==(const aligned_allocator<U, ALIGNMENT>&) const {
+      return true;
+    }
+    template <typename U>
+    bool operator!=(const aligned_allocator<U, ALIGNMENT>&) const {
+      return false;
+    }
+  };
+
+  template <typename color_depth_parameter>
+  class image_view;
+
   // A raster image, with a width, height, and (width x height)
   // pixels. Each pixel is an rgb<color_depth>. Ordinarily an image is
   // non-empty, with positive width, positive height, and a non-zero
@@ -28,6 +117,11 @@ namespace gfx {
   // zero width, zero height, and zero pixels. The empty state exists
   // primarily so that the default constructor can have well-defined
   // semantics.
+  //
+  // The pixels live in a single buffer aligned to PIXEL_ALIGNMENT
+  // bytes. Row y starts at row(y), and consecutive rows are pitch()
+  // pixels apart. For an image object pitch() always equals width(),
+  // so the whole buffer is [data(), data() + pitch() * height()).
   template <typename color_depth_parameter>
   class image {
   public:
@@ -36,10 +130,13 @@ namespace gfx {
     using color_depth = color_depth_parameter;
     using same_type = image<color_depth>;
     using rgb_type = rgb<color_depth>;
-    using row_type = std::vector<rgb_type>;
+    using buffer_type = std::vector<rgb_type,
+				    aligned_allocator<rgb_type, PIXEL_ALIGNMENT>>;
 
     // Default constructor. Creates an empty image.
-    image() {
+    image()
+      : _width(0),
+	_height(0) {
       assert(empty());
     }
 
@@ -52,24 +149,61 @@ namespace gfx {
       
       assert(width > 0);
       assert(height > 0);
-      
-      _rows.assign(height, row_type(width, default_color));
+
+      _pixels.assign(std::size_t(width) * height, default_color);
+      _width = width;
+      _height = height;
+    }
+
+    // Construct an image holding a copy of the pixels of view.
+    explicit image(const image_view<color_depth>& view)
+      : _width(0),
+	_height(0) {
+      assign(view);
     }
 
     // Copy constructor.
     image(const same_type& rhs)
-      : _rows(rhs._rows) { }
+      : _pixels(rhs._pixels),
+	_width(rhs._width),
+	_height(rhs._height) { }
+
+    // Move constructor. Takes over the pixel buffer of rhs in O(1)
+    // time, and leaves rhs empty.
+    image(same_type&& rhs) noexcept
+      : _pixels(std::move(rhs._pixels)),
+	_width(rhs._width),
+	_height(rhs._height) {
+      rhs._pixels.clear();
+      rhs._width = rhs._height = 0;
+    }
 
     // Assignment operator.
     same_type& operator=(const same_type& rhs) {
-      _rows = rhs._rows;
+      _pixels = rhs._pixels;
+      _width = rhs._width;
+      _height = rhs._height;
       return *this;
-    }      
+    }
+
+    // Move assignment operator. Takes over the pixel buffer of rhs in
+    // O(1) time, and leaves rhs empty.
+    same_type& operator=(same_type&& rhs) noexcept {
+      if (this != &rhs) {
+	_pixels = std::move(rhs._pixels);
+	_width = rhs._width;
+	_height = rhs._height;
+	rhs._pixels.clear();
+	rhs._width = rhs._height = 0;
+      }
+      return *this;
+    }
 
     // Equality operator.
     bool operator==(const same_type& rhs) const {
-      return ((empty() == rhs.empty()) &&
-	      std::equal(_rows.begin(), _rows.end(), rhs._rows.begin()));
+      return ((width() == rhs.width()) &&
+	      (height() == rhs.height()) &&
+	      std::equal(_pixels.begin(), _pixels.end(), rhs._pixels.begin()));
     }
 
     // Non-equality operator.
@@ -77,6 +211,25 @@ namespace gfx {
       return ! (*this == rhs);
     }
 
+    // Make this image a copy of the pixels of view, which must not
+    // refer to this image's own pixels. If view is empty, this image
+    // becomes empty.
+    void assign(const image_view<color_depth>& view) {
+      if (view.empty()) {
+	clear();
+      } else {
+	buffer_type copied(std::size_t(view.width()) * view.height());
+	for (int y = 0; y < view.height(); ++y) {
+	  std::copy(view.row(y),
+		    view.row(y) + view.width(),
+		    copied.begin() + std::size_t(y) * view.width());
+	}
+	_pixels.swap(copied);
+	_width = view.width();
+	_height = view.height();
+      }
+    }
+
     // Determine whether this image is almost equal to rhs. Returns
     // true when this and rhs have the same emptiness-state, width,
     // height, and every pixel of this is almost_equal to the
@@ -95,24 +248,17 @@ namespace gfx {
 	  return rgb_l.almost_equal(rgb_r, delta);
 	};
 
-        auto row_almost_equal = [&](const row_type& row_l,
-				    const row_type& row_r) {
-	  return std::equal(row_l.begin(),
-			    row_l.end(),
-			    row_r.begin(),
-			    rgb_almost_equal);
-	};
-
-        return std::equal(_rows.begin(),
-			  _rows.end(),
-			  rhs._rows.begin(),
-			  row_almost_equal);
+        return std::equal(_pixels.begin(),
+			  _pixels.end(),
+			  rhs._pixels.begin(),
+			  rgb_almost_equal);
       }
     }
 
-    // Make this image empty.
+    // Make this image empty. This releases the pixel buffer.
     void clear() {
-      _rows.clear();
+      buffer_type().swap(_pixels);
+      _width = _height = 0;
       assert(empty());
     }
 
@@ -128,50 +274,58 @@ namespace gfx {
 
 	result.same_size(*this);
 
-	for (int x = 0; x < width(); ++x) {
-	  for (int y = 0; y < height(); ++y) {
-	    result.pixel(x, y) = pixel(x, y).template convert_to<new_color_depth>();
+	for (int y = 0; y < height(); ++y) {
+	  const rgb_type* source = row(y);
+	  auto destination = result.row(y);
+	  for (int x = 0; x < width(); ++x) {
+	    destination[x] = source[x].template convert_to<new_color_depth>();
 	  }
 	}
       }
     }
 
+    // Return a pointer to the first pixel of the buffer, i.e. the
+    // top-left pixel. Pixel (x, y) is at data()[y * pitch() + x]. When
+    // this image is empty, returns nullptr.
+    const rgb_type* data() const {
+      return empty() ? nullptr : _pixels.data();
+    }
+    rgb_type* data() {
+      return empty() ? nullptr : _pixels.data();
+    }
+
     // Return true iff this image is empty.
     bool empty() const {
-      return _rows.empty();
+      return _pixels.empty();
     }
 
-    // Return an estimate of the number of bytes used to store pixel
-    // data for this image, calculated by
+    // Return the number of bytes used to store pixel data for this
+    // image, calculated by
     //
-    // width * height * (bytes per pixel) .
+    // pitch * height * (bytes per pixel) .
     //
-    // This is only an estimate and does not include the image<>
-    // object overhead nor overhead from the std::vector data
-    // structure.
+    // Since rgb objects are packed (see gfxcolor.hh), this is the real
+    // size of the pixel buffer. It does not include the image<>
+    // object overhead nor the alignment slack of the allocation.
     //
     // When this image is empty, returns 0.
-    int estimate_bytes() const {
+    std::size_t estimate_bytes() const {
       if (empty()) {
 	return 0;
       } else {
-        return width() * height() * sizeof(rgb_type);
+        return std::size_t(pitch()) * height() * sizeof(rgb_type);
       }
     }
 
     // Overwrite every pixel with default_color.
     void fill(const rgb_type& default_color) {
-      for (int y = 0; y < height(); ++y) {
-	for (int x = 0; x < width(); ++x) {
-	  pixel(x, y) = default_color;
-	}
-      }
+      std::fill(_pixels.begin(), _pixels.end(), default_color);
     }
 
     // Return the height of this image. When the image is empty,
     // returns 0.
     int height() const {
-      return _rows.size();
+      return _height;
     }
 
     // Return true iff x is a valid x-coordinate for this image.
@@ -190,7 +344,7 @@ namespace gfx {
       assert(!empty());
       assert(is_x(x));
       assert(is_y(y));
-      return _rows[y][x];
+      return _pixels[std::size_t(y) * pitch() + x];
     }
 
     // Return a mutable reference to the pixel at (x, y), which must
@@ -199,7 +353,13 @@ namespace gfx {
       assert(!empty());
       assert(is_x(x));
       assert(is_y(y));
-      return _rows[y][x];
+      return _pixels[std::size_t(y) * pitch() + x];
+    }
+
+    // Return the distance, in pixels, between the starts of
+    // consecutive rows. When the image is empty, returns 0.
+    int pitch() const {
+      return _width;
     }
 
     // Change this image's width to new_width, and its height to
@@ -217,13 +377,20 @@ namespace gfx {
 
       if ((width() != new_width) || (height() != new_height)) {
 
-	// height
-	_rows.resize(new_height, std::vector<rgb_type>(width(), default_color));
-	
-	// width
-	for (auto&& row : _rows) {
-	  row.resize(new_width, default_color);
+	buffer_type resized(std::size_t(new_width) * new_height, default_color);
+
+	// Copy over the top-left region that both sizes have in common.
+	int keep_width = std::min(width(), new_width),
+	  keep_height = std::min(height(), new_height);
+	for (int y = 0; y < keep_height; ++y) {
+	  std::copy(row(y),
+		    row(y) + keep_width,
+		    resized.begin() + std::size_t(y) * new_width);
 	}
+
+	_pixels.swap(resized);
+	_width = new_width;
+	_height = new_height;
       }
 
       assert(!empty());
@@ -231,6 +398,18 @@ namespace gfx {
       assert(width() == new_width);
     }
 
+    // Return a pointer to the first (leftmost) pixel of row y, which
+    // must be a valid y-coordinate. The row's width() pixels are
+    // contiguous.
+    const rgb_type* row(int y) const {
+      assert(is_y(y));
+      return _pixels.data() + std::size_t(y) * pitch();
+    }
+    rgb_type* row(int y) {
+      assert(is_y(y));
+      return _pixels.data() + std::size_t(y) * pitch();
+    }
+
     // Make this image have the same size as other. If other is empty,
     // this function is equivalent to
     //
@@ -249,25 +428,287 @@ namespace gfx {
 	resize(other.width(), other.height(), default_color);
       }
     }
+    template <typename other_color_depth>
+    void same_size(const image_view<other_color_depth>& other,
+		   const rgb_type& default_color = BLACK.convert_to<color_depth>()) {
+      if (other.empty()) {
+	clear();
+      } else {
+	resize(other.width(), other.height(), default_color);
+      }
+    }
 
     // Swap contents with other.
     void swap(same_type& other) {
-      _rows.swap(other._rows);
+      _pixels.swap(other._pixels);
+      std::swap(_width, other._width);
+      std::swap(_height, other._height);
+    }
+
+    // Return a view of the entire image. The view is only valid
+    // until this image is resized, cleared, or destroyed.
+    image_view<color_depth> view() const {
+      return image_view<color_depth>(*this);
+    }
+
+    // Return a view of the rectangular region of this image with the
+    // given top-left corner, width, and height. The rectangle must be
+    // non-empty and fit inside this image. This takes O(1) time.
+    image_view<color_depth> view(int left,
+				 int top,
+				 int width,
+				 int height) const {
+      return view().subview(left, top, width, height);
     }
 
     // Return the width of this image. When the image is empty,
     // returns 0.
     int width() const {
-      if (empty()) {
-	return 0;
-      } else {
-	return _rows[0].size();
+      return _width;
+    }
+
+  private:
+
+    buffer_type _pixels;
+    int _width, _height;
+  };
+
+  // A read-only view of a rectangle of pixels owned by something
+  // else. A view has an origin (pointer to its top-left pixel), a
+  // width, a height, and a pitch, which is the distance in pixels
+  // between the starts of consecutive rows in the parent buffer. A
+  // view of a whole image has pitch() == width(); a subview usually
+  // has pitch() > width(). Like image, a view may be empty, with zero
+  // width and height.
+  //
+  // A view does not own its pixels, so it becomes invalid when its
+  // parent is resized, cleared, or destroyed. A filter's input view
+  // must not refer to the filter's output image.
+  template <typename color_depth_parameter>
+  class image_view {
+  public:
+
+    // Type aliases.
+    using color_depth = color_depth_parameter;
+    using same_type = image_view<color_depth>;
+    using rgb_type = rgb<color_depth>;
+
+    // Default constructor. Creates an empty view.
+    image_view()
+      : _origin(nullptr),
+	_width(0),
+	_height(0),
+	_pitch(0) { }
+
+    // Create a view of width x height pixels, whose top-left pixel is
+    // at origin, with consecutive rows pitch pixels apart. width and
+    // height must be positive, and pitch must be at least width.
+    image_view(const rgb_type* origin,
+	       int width,
+	       int height,
+	       int pitch)
+      : _origin(origin),
+	_width(width),
+	_height(height),
+	_pitch(pitch) {
+      assert(origin != nullptr);
+      assert(width > 0);
+      assert(height > 0);
+      assert(pitch >= width);
+    }
+
+    // Create a view of an entire image. This conversion is implicit
+    // so that an image can be passed wherever a view is expected.
+    image_view(const image<color_depth>& whole)
+      : _origin(whole.data()),
+	_width(whole.width()),
+	_height(whole.height()),
+	_pitch(whole.pitch()) { }
+
+    // Return a pointer to the top-left pixel, or nullptr when this
+    // view is empty.
+    const rgb_type* data() const {
+      return _origin;
+    }
+
+    // Return true iff this view is empty.
+    bool empty() const {
+      return (_width == 0);
+    }
+
+    // Return the height of this view, or 0 when it is empty.
+    int height() const {
+      return _height;
+    }
+
+    // Return true iff the rows of this view are adjacent in memory,
+    // so that all its pixels are [data(), data() + width() * height()).
+    bool is_contiguous() const {
+      return (_pitch == _width);
+    }
+
+    // Return true iff x is a valid x-coordinate for this view.
+    bool is_x(int x) const {
+      return !empty() && ((x >= 0) && (x < width()));
+    }
+
+    // Return true iff y is a valid y-coordinate for this view.
+    bool is_y(int y) const {
+      return !empty() && ((y >= 0) && (y < height()));
+    }
+
+    // Return the distance, in pixels, between the starts of
+    // consecutive rows.
+    int pitch() const {
+      return _pitch;
+    }
+
+    // Return a const reference to the pixel at (x, y), which must be
+    // valid coordinates.
+    const rgb_type& pixel(int x, int y) const {
+      assert(is_x(x));
+      assert(is_y(y));
+      return _origin[std::size_t(y) * _pitch + x];
+    }
+
+    // Return a pointer to the leftmost pixel of row y, which must be
+    // a valid y-coordinate. The row's width() pixels are contiguous.
+    const rgb_type* row(int y) const {
+      assert(is_y(y));
+      return _origin + std::size_t(y) * _pitch;
+    }
+
+    // Return a view of the rectangular region of this view with the
+    // given top-left corner, width, and height. The rectangle must be
+    // non-empty and fit inside this view. This takes O(1) time and
+    // copies no pixels.
+    same_type subview(int left,
+		      int top,
+		      int width,
+		      int height) const {
+      assert(is_x(left));
+      assert(is_y(top));
+      assert(width > 0);
+      assert(height > 0);
+      assert(is_x(left + width - 1));
+      assert(is_y(top + height - 1));
+      return same_type(&pixel(left, top), width, height, _pitch);
+    }
+
+    // Return the width of this view, or 0 when it is empty.
+    int width() const {
+      return _width;
+    }
+
+  private:
+
+    const rgb_type* _origin;
+    int _width, _height, _pitch;
+  };
+
+  // input_view<color_depth> is a synonym for image_view<color_depth>
+  // that does not participate in template argument deduction. Filters
+  // declare their input with it, so that color_depth is deduced from
+  // the output image alone, and both images and views are accepted as
+  // input.
+  template <typename color_depth>
+  struct input_view_type {
+    using type = image_view<color_depth>;
+  };
+  template <typename color_depth>
+  using input_view = typename input_view_type<color_depth>::type;
+
+  // A border_policy defines the pixel read at coordinates outside an
+  // image of width n, for out-of-range coordinate i:
+  //
+  //     BORDER_CLAMP     repeat the nearest edge pixel (like extend_edges)
+  //     BORDER_MIRROR    reflect about the edge, repeating the edge pixel,
+  //                      so -1 reads 0, -2 reads 1, n reads n-1
+  //     BORDER_WRAP      wrap around to the opposite edge, so -1 reads n-1
+  //     BORDER_CONSTANT  read a fixed border color
+  enum border_policy { BORDER_CLAMP    = 0,
+		       BORDER_MIRROR   = 1,
+		       BORDER_WRAP     = 2,
+		       BORDER_CONSTANT = 3 };
+
+  // Map coordinate i, which may be out of range, to a valid index into
+  // a row or column of n > 0 pixels according to POLICY. Returns -1
+  // when POLICY is BORDER_CONSTANT and i is out of range.
+  template <border_policy POLICY>
+  int border_index(int i, int n) {
+    assert(n > 0);
+    if ((i >= 0) && (i < n)) {
+      return i;
+    }
+    switch (POLICY) {
+    case BORDER_CLAMP:
+      return (i < 0) ? 0 : (n - 1);
+    case BORDER_MIRROR:
+      {
+	int period = 2 * n,
+	  m = ((i % period) + period) % period;
+	return (m < n) ? m : (period - 1 - m);
+      }
+    case BORDER_WRAP:
+      return ((i % n) + n) % n;
+    case BORDER_CONSTANT:
+    default:
+      return -1;
+    }
+  }
+
+  // A read-only view that may be read at any coordinates, including
+  // ones outside the underlying image_view; out-of-range reads are
+  // resolved by POLICY. The view must be non-empty.
+  template <typename color_depth_parameter, border_policy POLICY>
+  class bordered_view {
+  public:
+
+    // Type aliases.
+    using color_depth = color_depth_parameter;
+    using rgb_type = rgb<color_depth>;
+
+    // Wrap view. border_color is only used by BORDER_CONSTANT.
+    bordered_view(const image_view<color_depth>& view,
+		  const rgb_type& border_color = BLACK.convert_to<color_depth>())
+      : _view(view),
+	_border_color(border_color) {
+      assert(!view.empty());
+    }
+
+    // Return the height of the underlying view.
+    int height() const {
+      return _view.height();
+    }
+
+    // Return the pixel at (x, y), which may be any coordinates.
+    const rgb_type& pixel(int x, int y) const {
+      if ((unsigned(x) < unsigned(_view.width())) &&
+	  (unsigned(y) < unsigned(_view.height()))) {
+	return _view.pixel(x, y);
+      }
+      int in_x = border_index<POLICY>(x, _view.width()),
+	in_y = border_index<POLICY>(y, _view.height());
+      if ((in_x < 0) || (in_y < 0)) {
+	return _border_color;
       }
+      return _view.pixel(in_x, in_y);
+    }
+
+    // Return the underlying view.
+    const image_view<color_depth>& view() const {
+      return _view;
+    }
+
+    // Return the width of the underlying view.
+    int width() const {
+      return _view.width();
     }
 
   private:
 
-    std::vector<row_type> _rows;
+    image_view<color_depth> _view;
+    rgb_type _border_color;
   };
 
   // Aliases for widely-used color depths.
@@ -275,4 +716,8 @@ namespace gfx {
   using true_color_image = image<true_color_depth>;
   
   using hdr_image = image<hdr_color_depth>;
+
+  using true_color_view = image_view<true_color_depth>;
+
+  using hdr_view = image_view<hdr_color_depth>;
 }
@@ -0,0 +1,201 @@
+///////////////////////////////////////////////////////////////////////////////
+// gfximage_bench.cc
+//
+// Timing benchmarks for gfxfilter.hh, gfxppm.hh, gfxsimd.hh and gfxthread.hh .
+// Run with
+//
+//     make bench
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <vector>
+
+#include "gfxfilter.hh"
+#include "gfximage.hh"
+#include "gfxppm.hh"
+#include "gfxsimd.hh"
+#include "gfxthread.hh"
+
+// Return the number of milliseconds it takes to run f once.
+double time_ms(const std::function<void()>& f) {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// Fill image with pseudo-random pixels, using a fixed seed so that
+// every run does identical work.
+void fill_noise(gfx::true_color_image& image) {
+  srand(1);
+  for (int y = 0; y < image.height(); ++y) {
+    for (int x = 0; x < image.width(); ++x) {
+      image.pixel(x, y).assign(rand() % 256, rand() % 256, rand() % 256);
+    }
+  }
+}
+
+int main() {
+
+  const int WIDTH = 1920, HEIGHT = 1080;
+
+  gfx::true_color_image before(WIDTH, HEIGHT), after;
+  fill_noise(before);
+
+  // box_blur should take about the same time for every radius.
+  std::printf("box_blur on %dx%d true color\n", WIDTH, HEIGHT);
+  std::printf("%8s %12s %14s\n", "radius", "ms", "ns per pixel");
+  for (int radius = 1; radius <= 64; radius *= 2) {
+    double ms = time_ms([&]() { box_blur(after, before, radius); });
+    std::printf("%8d %12.2f %14.2f\n",
+		radius,
+		ms,
+		ms * 1e6 / (double(WIDTH) * HEIGHT));
+  }
+
+  // edge_detect is a single pass, so it should cost a small constant
+  // factor more than copying the frame.
+  std::printf("\nedge_detect on %dx%d true color\n", WIDTH, HEIGHT);
+  double ms = time_ms([&]() { edge_detect(after, before); });
+  std::printf("%12.2f ms %14.2f ns per pixel\n",
+	      ms,
+	      ms * 1e6 / (double(WIDTH) * HEIGHT));
+
+  // convolve with integer (fixed-point) and fractional kernels.
+  std::printf("\nconvolve on %dx%d true color\n", WIDTH, HEIGHT);
+  ms = time_ms([&]() { convolve(after, before, gfx::sharpen_kernel()); });
+  std::printf("%20s %12.2f ms\n", "3x3 sharpen", ms);
+  const float ninth = 1.0f / 9.0f;
+  gfx::matrix3x3<float> box({ninth, ninth, ninth, ninth, ninth, ninth, ninth, ninth, ninth});
+  ms = time_ms([&]() { convolve(after, before, box); });
+  std::printf("%20s %12.2f ms\n", "3x3 box", ms);
+
+  // A separable 7x7 kernel, forced through the 2-D path and then
+  // through the two 1-D passes convolve would pick by itself.
+  gfx::vector<float, 7> row7({1 / 64.0f, 6 / 64.0f, 15 / 64.0f, 20 / 64.0f, 15 / 64.0f, 6 / 64.0f, 1 / 64.0f});
+  gfx::matrix<float, 7, 7> kernel7({0});
+  for (int i = 0; i < 7; ++i) {
+    for (int j = 0; j < 7; ++j) {
+      kernel7[i][j] = row7[i] * row7[j];
+    }
+  }
+  ms = time_ms([&]() { gfx::convolve_with_border<gfx::BORDER_CLAMP>(after, before, kernel7); });
+  std::printf("%20s %12.2f ms\n", "7x7 binomial, 2-D", ms);
+  ms = time_ms([&]() { gfx::convolve_separable(after, before, row7, row7); });
+  std::printf("%20s %12.2f ms\n", "7x7 binomial, 1-D", ms);
+
+  // grayscale with each kernel gfxsimd.hh offers, up to the widest this
+  // CPU supports.
+  std::printf("\ngrayscale kernels on %dx%d\n", WIDTH, HEIGHT);
+  std::printf("%20s %12s %12s\n", "kernel", "true color", "HDR");
+  gfx::hdr_image hdr_before, hdr_after;
+  before.convert_to(hdr_before);
+  hdr_after.same_size(hdr_before);
+  after.same_size(before);
+  const char* level_names[] = {"scalar", "SSE2", "AVX2"};
+  for (int level = gfx::SIMD_SCALAR; level <= gfx::detected_simd_level(); ++level) {
+    double true_color_ms = time_ms([&]() {
+	gfx::gray_row(&before.row(0)[0][0], &after.row(0)[0][0], WIDTH * HEIGHT,
+		      gfx::fixed_point_luminance_weights(gfx::LUMINANCE_DEFAULT), gfx::simd_level(level));
+      }),
+      hdr_ms = time_ms([&]() {
+	  gfx::gray_row(&hdr_before.row(0)[0][0], &hdr_after.row(0)[0][0], WIDTH * HEIGHT,
+			gfx::float_luminance_weights(gfx::LUMINANCE_DEFAULT), gfx::simd_level(level));
+	});
+    std::printf("%20s %9.2f ms %9.2f ms\n", level_names[level], true_color_ms, hdr_ms);
+  }
+
+  // Filters split into tiles, column strips or row bands on a thread
+  // pool. With one hardware thread this only shows the cost of the
+  // splitting itself.
+  gfx::thread_pool pool;
+  std::printf("\nfilters on %dx%d true color, %d threads\n", WIDTH, HEIGHT, pool.thread_count());
+  std::printf("%20s %12s %12s\n", "filter", "sequential", "parallel");
+  auto compare = [&](const char* name,
+		     const std::function<void(const gfx::execution_policy&)>& filter) {
+    double sequential = time_ms([&]() { filter(gfx::sequential()); }),
+      parallel = time_ms([&]() { filter(gfx::parallel(pool)); });
+    std::printf("%20s %9.2f ms %9.2f ms\n", name, sequential, parallel);
+  };
+  compare("grayscale", [&](const gfx::execution_policy& p) { grayscale(p, after, before); });
+  compare("scale_component", [&](const gfx::execution_policy& p) { scale_component(p, after, before, gfx::RGB_INDEX_RED, 1.5); });
+  compare("extend_edges", [&](const gfx::execution_policy& p) { extend_edges(p, after, before, 8); });
+  compare("edge_detect", [&](const gfx::execution_policy& p) { edge_detect(p, after, before); });
+  compare("box_blur, radius 4", [&](const gfx::execution_policy& p) { box_blur(p, after, before, 4); });
+  compare("box_blur, radius 64", [&](const gfx::execution_policy& p) { box_blur(p, after, before, 64); });
+  compare("3x3 sharpen", [&](const gfx::execution_policy& p) { convolve(p, after, before, gfx::sharpen_kernel()); });
+
+  // The same bands on a work-stealing scheduler, and how evenly its
+  // threads were kept busy. Use at least four threads so that there
+  // is something to balance.
+  gfx::scheduler tasks(std::max(4, pool.thread_count()));
+  ms = time_ms([&]() { box_blur(gfx::parallel(tasks), after, before, 4); });
+  std::printf("%20s %22.2f ms\n", "box_blur, stealing", ms);
+  std::vector<gfx::scheduler::worker_stats> stats = tasks.stats();
+  for (std::size_t i = 0; i < stats.size(); ++i) {
+    std::printf("%14s %2zu: busy %7.2f ms, idle %7.2f ms, %3zu tasks, %3zu stolen\n",
+		"thread",
+		i,
+		stats[i].busy_seconds * 1e3,
+		stats[i].idle_seconds * 1e3,
+		stats[i].tasks,
+		stats[i].steals);
+  }
+
+  // A 4-stage color correction, as separate filters and fused into a
+  // single pass.
+  std::printf("\ncolor correction on %dx%d true color\n", WIDTH, HEIGHT);
+  gfx::true_color_image temp1, temp2;
+  ms = time_ms([&]() {
+      scale_component(temp1, before, gfx::RGB_INDEX_RED, 1.1);
+      scale_component(temp2, temp1, gfx::RGB_INDEX_BLUE, 0.9);
+      clear_component(temp1, temp2, gfx::RGB_INDEX_GREEN);
+      grayscale(after, temp1);
+    });
+  std::printf("%20s %12.2f ms\n", "separate filters", ms);
+  auto correct = gfx::pixel_pipeline<>()
+    .then(gfx::scale_component_op(gfx::RGB_INDEX_RED, 1.1))
+    .then(gfx::scale_component_op(gfx::RGB_INDEX_BLUE, 0.9))
+    .then(gfx::clear_component_op(gfx::RGB_INDEX_GREEN))
+    .then(gfx::grayscale_op());
+  ms = time_ms([&]() { correct.apply(after, before); });
+  std::printf("%20s %12.2f ms\n", "pixel_pipeline", ms);
+
+  // ppm_read should be close to the speed of the underlying file
+  // reads.
+  std::printf("\nppm_read of %dx%d true color\n", WIDTH, HEIGHT);
+  const std::string temp_path("bench_temp.ppm");
+  gfx::ppm_write(before, temp_path);
+  ms = time_ms([&]() { gfx::ppm_read(after, temp_path); });
+  std::printf("%20s %12.2f ms\n", "binary", ms);
+  ms = time_ms([&]() { gfx::mapped_ppm mapped(temp_path); grayscale(after, mapped); });
+  std::printf("%20s %12.2f ms\n", "mapped + grayscale", ms);
+  gfx::true_color_image frame;
+  ms = time_ms([&]() { gfx::ppm_read(frame, temp_path); grayscale(after, frame); });
+  std::printf("%20s %12.2f ms\n", "read + grayscale", ms);
+  gfx::ppm_write(before, temp_path, false);
+  ms = time_ms([&]() { gfx::ppm_read(after, temp_path); });
+  std::printf("%20s %12.2f ms\n", "ASCII", ms);
+  gfx::hdr_image hdr;
+  before.convert_to(hdr);
+  gfx::ppm_write(hdr, temp_path);
+  ms = time_ms([&]() { gfx::ppm_read(hdr, temp_path); });
+  std::printf("%20s %12.2f ms\n", "16-bit binary to HDR", ms);
+  std::remove(temp_path.c_str());
+
+  std::printf("\nppm_write of %dx%d true color\n", WIDTH, HEIGHT);
+  ms = time_ms([&]() { gfx::ppm_write(before, temp_path); });
+  std::printf("%20s %12.2f ms\n", "binary", ms);
+  ms = time_ms([&]() { gfx::ppm_write(before.view(1, 1, WIDTH - 2, HEIGHT - 2), temp_path); });
+  std::printf("%20s %12.2f ms\n", "binary, view", ms);
+  ms = time_ms([&]() { gfx::ppm_write(before, temp_path, false); });
+  std::printf("%20s %12.2f ms\n", "ASCII", ms);
+  std::remove(temp_path.c_str());
+
+  return 0;
+}
@@ -1,19 +1,54 @@
 ///////////////////////////////////////////////////////////////////////////////
 // gfximage_test.cc
 //
-// Unit tests for gfxcolor.hh , gfximage.hh , gfxppm.hh
+// Unit tests for gfxcolor.hh , gfximage.hh , gfxintegral.hh , gfxppm.hh
 //
 ///////////////////////////////////////////////////////////////////////////////
 
+#include <atomic>
 #include <cstdio> // for remove()
+#include <cstdlib>
+#include <new>
+#include <sstream>
 
 #include "rubrictest.hh"
 
 #include "gfxcolor.hh"
 #include "gfxfilter.hh"
 #include "gfximage.hh"
+#include "gfxintegral.hh"
 #include "gfxppm.hh"
 
+// Every allocation through operator new is counted, so that tests can
+// check that a code path does not allocate.
+static std::atomic<std::size_t> allocation_count(0);
+
+void* operator new(std::size_t size) {
+  ++allocation_count;
+  if (void* p = std::malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+// Return a width x height image whose pixels vary across both axes
+// and all three channels, so that filters have something to mix.
+static gfx::true_color_image pattern_image(int width, int height) {
+  gfx::true_color_image image(width, height);
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      image.pixel(x, y).assign((x * 37 + y * 11) % 256,
+			       (x * y * 7) % 256,
+			       (x + y * 53) % 256);
+    }
+  }
+  return image;
+}
+
 int main() {
 
   Rubric r;
@@ -247,6 +282,8 @@ int main() {
 		TEST_EQUAL("image::estimate_bytes", 0, true_empty.estimate_bytes());
 		TEST_EQUAL("image::estimate_bytes", 100*200*sizeof(gfx::true_color_rgb), true_blue.estimate_bytes());
 		TEST_EQUAL("image::estimate_bytes", 300*400*sizeof(gfx::hdr_rgb), hdr_black.estimate_bytes());
+		TEST_EQUAL("image::estimate_bytes", 100*200*3, true_blue.estimate_bytes());
+		TEST_EQUAL("image::estimate_bytes", 300*400*12, hdr_black.estimate_bytes());
 
 		{
 		  auto true_red(true_blue);
@@ -318,6 +355,111 @@ int main() {
 		TEST_EQUAL("image::width", 300, hdr_black.width());
 	      });
 
+  r.criterion("image contiguous storage",
+	      1,
+	      [&]() {
+		gfx::true_color_image empty, img(30, 20, gfx::BLUE);
+
+		TEST_TRUE("image::data", empty.data() == nullptr);
+		TEST_EQUAL("image::pitch", 0, empty.pitch());
+		TEST_EQUAL("image::pitch", 30, img.pitch());
+		TEST_EQUAL("image::data alignment",
+			   0,
+			   reinterpret_cast<std::uintptr_t>(img.data()) % gfx::PIXEL_ALIGNMENT);
+
+		img.pixel(7, 5) = gfx::RED;
+		TEST_EQUAL("image::data", gfx::RED, img.data()[5 * img.pitch() + 7]);
+		TEST_EQUAL("image::row", gfx::RED, img.row(5)[7]);
+		for (int y = 1; y < img.height(); ++y) {
+		  TEST_EQUAL("image::row", img.row(y - 1) + img.pitch(), img.row(y));
+		}
+
+		// resize must keep the top-left region in place
+		img.resize(40, 10, gfx::WHITE);
+		TEST_EQUAL("image::resize keeps pixels", gfx::RED, img.row(5)[7]);
+		TEST_EQUAL("image::resize keeps pixels", gfx::BLUE, img.row(9)[29]);
+		TEST_EQUAL("image::resize new pixels", gfx::WHITE, img.row(9)[30]);
+		TEST_EQUAL("image::pitch", 40, img.pitch());
+	      });
+
+  r.criterion("image_view",
+	      1,
+	      [&]() {
+		gfx::true_color_image before, cropped, after;
+		TEST_TRUE("image_view : load before image",
+			  gfx::ppm_read(before, binary_ppm_path));
+
+		gfx::true_color_view whole(before), empty;
+		TEST_TRUE("image_view::image_view()", empty.empty());
+		TEST_EQUAL("image_view::image_view(image)", before.data(), whole.data());
+		TEST_TRUE("image_view::is_contiguous", whole.is_contiguous());
+
+		gfx::true_color_view region = before.view(5, 10, 160, 120);
+		TEST_EQUAL("image_view::subview", 160, region.width());
+		TEST_EQUAL("image_view::subview", 120, region.height());
+		TEST_EQUAL("image_view::subview", before.pitch(), region.pitch());
+		TEST_FALSE("image_view::subview", region.is_contiguous());
+		TEST_EQUAL("image_view::subview", &before.pixel(5, 10), region.data());
+		TEST_EQUAL("image_view::subview", &before.pixel(9, 17), &region.pixel(4, 7));
+		TEST_EQUAL("image_view::subview", &before.pixel(10, 20),
+			   &region.subview(1, 2, 10, 10).pixel(4, 8));
+
+		// copying a view is the same as cropping
+		crop(cropped, before, 5, 10, 160, 120);
+		TEST_EQUAL("image::image(view)", cropped, gfx::true_color_image(region));
+
+		// filters accept views
+		clear_component(after, region, gfx::RGB_INDEX_RED);
+		gfx::true_color_image expected;
+		clear_component(expected, cropped, gfx::RGB_INDEX_RED);
+		TEST_EQUAL("clear_component(view)", expected, after);
+
+		// ppm_write accepts views
+		const std::string temp_path("temp.ppm");
+		TEST_TRUE("ppm_write(view)", gfx::ppm_write(region, temp_path));
+		TEST_TRUE("ppm_write(view)", gfx::ppm_read(after, temp_path));
+		TEST_EQUAL("ppm_write(view)", cropped, after);
+		remove(temp_path.c_str());
+	      });
+
+  r.criterion("move semantics",
+	      1,
+	      [&]() {
+		gfx::true_color_image source(30, 20, gfx::TEAL);
+		const gfx::true_color_rgb* buffer = source.data();
+
+		gfx::true_color_image moved(std::move(source));
+		TEST_TRUE("image::image(image&&)", source.empty());
+		TEST_EQUAL("image::image(image&&)", 0, source.width());
+		TEST_EQUAL("image::image(image&&)", buffer, moved.data());
+		TEST_EQUAL("image::image(image&&)", gfx::TEAL, moved.pixel(29, 19));
+
+		gfx::true_color_image assigned(5, 5);
+		assigned = std::move(moved);
+		TEST_TRUE("image::operator=(image&&)", moved.empty());
+		TEST_EQUAL("image::operator=(image&&)", buffer, assigned.data());
+		TEST_EQUAL("image::operator=(image&&)", 30, assigned.width());
+
+		gfx::vector3<double> v{1.0, 2.0, 3.0}, w(std::move(v));
+		TEST_EQUAL("vector::vector(vector&&)", 2.0, w[1]);
+		gfx::matrix2x2<int> m({1, 2, 3, 4}), n;
+		n = std::move(m);
+		TEST_EQUAL("matrix::operator=(matrix&&)", 4, n[1][1]);
+
+		// filters that return by value agree with the out-parameter versions
+		gfx::true_color_image before, expected;
+		TEST_TRUE("filter by value : load before image",
+			  gfx::ppm_read(before, binary_ppm_path));
+		grayscale(expected, before);
+		TEST_EQUAL("grayscale by value", expected, gfx::grayscale(before));
+		crop(expected, before, 5, 10, 160, 120);
+		TEST_EQUAL("crop by value", expected, gfx::crop(before, 5, 10, 160, 120));
+		edge_detect(expected, before.view(5, 10, 160, 120));
+		TEST_EQUAL("edge_detect by value",
+			   expected,
+			   gfx::edge_detect(gfx::crop(before, 5, 10, 160, 120)));
+	      });
+
   r.criterion("gfxppm still works",
 	      1,
 	      [&]() {
@@ -713,5 +855,1533 @@ int main() {
 			  after.almost_equal(expected, HDR_DELTA));
 	      });
 
+  r.criterion("box_blur matches direct window average",
+	      1,
+	      [&]() {
+		auto check = [&](int width, int height, const std::vector<int>& radii) {
+		  gfx::true_color_image before = pattern_image(width, height);
+
+		  for (int radius : radii) {
+		    gfx::true_color_image extended, after;
+		    extend_edges(extended, before, radius);
+		    box_blur(after, before, radius);
+		    int area = (2 * radius + 1) * (2 * radius + 1);
+		    for (int y = 0; y < before.height(); ++y) {
+		      for (int x = 0; x < before.width(); ++x) {
+			for (int i = 0; i < 3; ++i) {
+			  int sum = 0;
+			  for (int dy = 0; dy <= 2 * radius; ++dy) {
+			    for (int dx = 0; dx <= 2 * radius; ++dx) {
+			      sum += extended.pixel(x + dx, y + dy)[i];
+			    }
+			  }
+			  TEST_EQUAL("box_blur : window average",
+				     sum / area,
+				     after.pixel(x, y)[i]);
+			}
+		      }
+		    }
+		  }
+		};
+
+		// radius 12 makes the window wider than the image
+		check(23, 17, {1, 2, 5, 12});
+
+		// several column strips, the last one narrower, with a
+		// window reaching past a whole strip
+		check(150, 5, {1, 5, 70});
+	      });
+
+  r.criterion("border policies",
+	      1,
+	      [&]() {
+		// border_index on a 4-pixel row
+		const int coordinates[] = {-5, -1, 0, 3, 4, 9};
+		const int clamped[] = {0, 0, 0, 3, 3, 3},
+		  mirrored[] = {3, 0, 0, 3, 3, 1},
+		  wrapped[] = {3, 3, 0, 3, 0, 1},
+		  constant[] = {-1, -1, 0, 3, -1, -1};
+		for (int k = 0; k < 6; ++k) {
+		  TEST_EQUAL("border_index<BORDER_CLAMP>", clamped[k], gfx::border_index<gfx::BORDER_CLAMP>(coordinates[k], 4));
+		  TEST_EQUAL("border_index<BORDER_MIRROR>", mirrored[k], gfx::border_index<gfx::BORDER_MIRROR>(coordinates[k], 4));
+		  TEST_EQUAL("border_index<BORDER_WRAP>", wrapped[k], gfx::border_index<gfx::BORDER_WRAP>(coordinates[k], 4));
+		  TEST_EQUAL("border_index<BORDER_CONSTANT>", constant[k], gfx::border_index<gfx::BORDER_CONSTANT>(coordinates[k], 4));
+		}
+
+		// 13 columns are narrower than the widest window, and 140 make
+		// box_blur split the image into several column strips
+		for (int width : {13, 140}) {
+		  gfx::true_color_image before = pattern_image(width, 9);
+
+		  // box_blur under each policy equals a direct average over a bordered_view
+		  const gfx::true_color_rgb border_color(10, 200, 30);
+		  for (int radius : {1, 4, 11}) {
+		    gfx::true_color_image after[4];
+		    for (int policy = 0; policy < 4; ++policy) {
+		      box_blur(after[policy], before, radius, gfx::border_policy(policy), border_color);
+		    }
+		    gfx::bordered_view<gfx::true_color_depth, gfx::BORDER_CLAMP> clamp_source(before, border_color);
+		    gfx::bordered_view<gfx::true_color_depth, gfx::BORDER_MIRROR> mirror_source(before, border_color);
+		    gfx::bordered_view<gfx::true_color_depth, gfx::BORDER_WRAP> wrap_source(before, border_color);
+		    gfx::bordered_view<gfx::true_color_depth, gfx::BORDER_CONSTANT> constant_source(before, border_color);
+		    int area = (2 * radius + 1) * (2 * radius + 1);
+		    for (int y = 0; y < before.height(); ++y) {
+		      for (int x = 0; x < before.width(); ++x) {
+			for (int i = 0; i < 3; ++i) {
+			  int sums[4] = {0, 0, 0, 0};
+			  for (int dy = -radius; dy <= radius; ++dy) {
+			    for (int dx = -radius; dx <= radius; ++dx) {
+			      sums[0] += clamp_source.pixel(x + dx, y + dy)[i];
+			      sums[1] += mirror_source.pixel(x + dx, y + dy)[i];
+			      sums[2] += wrap_source.pixel(x + dx, y + dy)[i];
+			      sums[3] += constant_source.pixel(x + dx, y + dy)[i];
+			    }
+			  }
+			  for (int policy = 0; policy < 4; ++policy) {
+			    TEST_EQUAL("box_blur : bordered window average",
+				       sums[policy] / area,
+				       after[policy].pixel(x, y)[i]);
+			  }
+			}
+		      }
+		    }
+		  }
+		}
+
+		// edge_detect reads past the edges too; a flat image has no edges under any policy but BORDER_CONSTANT
+		gfx::true_color_image flat(10, 10, gfx::GRAY);
+		TEST_EQUAL("edge_detect : BORDER_CLAMP", gfx::true_color_image(10, 10, gfx::BLACK), edge_detect(flat, gfx::BORDER_CLAMP));
+		TEST_EQUAL("edge_detect : BORDER_MIRROR", gfx::true_color_image(10, 10, gfx::BLACK), edge_detect(flat, gfx::BORDER_MIRROR));
+		TEST_EQUAL("edge_detect : BORDER_WRAP", gfx::true_color_image(10, 10, gfx::BLACK), edge_detect(flat, gfx::BORDER_WRAP));
+		TEST_EQUAL("edge_detect : BORDER_CONSTANT", gfx::BLACK, edge_detect(flat, gfx::BORDER_CONSTANT).pixel(5, 5));
+		TEST_NOT_EQUAL("edge_detect : BORDER_CONSTANT", gfx::BLACK, edge_detect(flat, gfx::BORDER_CONSTANT).pixel(0, 5));
+	      });
+
+  r.criterion("integral_image",
+	      1,
+	      [&]() {
+		gfx::true_color_image before;
+		TEST_TRUE("integral_image : load before image",
+			  gfx::ppm_read(before, binary_ppm_path));
+
+		gfx::true_color_integral_image empty, table(before);
+		TEST_TRUE("integral_image::integral_image()", empty.empty());
+		TEST_EQUAL("integral_image::width", before.width(), table.width());
+		TEST_EQUAL("integral_image::height", before.height(), table.height());
+
+		const int rects[][4] = { {0, 0, 1, 1},
+					 {5, 10, 160, 120},
+					 {before.width() - 7, before.height() - 3, 7, 3},
+					 {0, 0, before.width(), before.height()} };
+		for (auto& rect : rects) {
+		  int64_t expected[3] = {0, 0, 0};
+		  for (int y = rect[1]; y < rect[1] + rect[3]; ++y) {
+		    for (int x = rect[0]; x < rect[0] + rect[2]; ++x) {
+		      for (int i = 0; i < 3; ++i) {
+			expected[i] += before.pixel(x, y)[i];
+		      }
+		    }
+		  }
+		  auto sum = table.rect_sum(rect[0], rect[1], rect[2], rect[3]);
+		  auto mean = table.rect_mean(rect[0], rect[1], rect[2], rect[3]);
+		  int64_t area = int64_t(rect[2]) * rect[3];
+		  for (int i = 0; i < 3; ++i) {
+		    TEST_EQUAL("integral_image::rect_sum", expected[i], sum[i]);
+		    TEST_EQUAL("integral_image::rect_mean", expected[i] / area, mean[i]);
+		  }
+		}
+
+		// a mean over a box blur window equals box_blur away from the edges
+		gfx::true_color_image blurred;
+		box_blur(blurred, before, 3);
+		TEST_EQUAL("integral_image::rect_mean", blurred.pixel(40, 30), table.rect_mean(37, 27, 7, 7));
+	      });
+
+  r.criterion("convolve",
+	      1,
+	      [&]() {
+		gfx::true_color_image before;
+		TEST_TRUE("convolve : load before image",
+			  gfx::ppm_read(before, binary_ppm_path));
+		gfx::hdr_image hdr_before;
+		before.convert_to(hdr_before);
+
+		// identity kernels of several sizes leave the image unchanged
+		TEST_EQUAL("convolve : 1x1 identity",
+			   before, gfx::convolve(before, gfx::matrix<float, 1, 1>({1})));
+		TEST_EQUAL("convolve : 3x3 identity",
+			   before, gfx::convolve(before, gfx::matrix3x3<float>({0, 0, 0, 0, 1, 0, 0, 0, 0})));
+		TEST_EQUAL("convolve : 5x3 identity",
+			   before, gfx::convolve(before, gfx::matrix<float, 3, 5>({0, 0, 0, 0, 0,
+										    0, 0, 1, 0, 0,
+										    0, 0, 0, 0, 0})));
+		TEST_EQUAL("convolve : 3x3 identity<hdr_color_depth>",
+			   hdr_before, gfx::convolve(hdr_before, gfx::matrix3x3<float>({0, 0, 0, 0, 1, 0, 0, 0, 0})));
+
+		// integer kernels on true color are exact
+		const gfx::matrix3x3<float> kernels[] = { gfx::sharpen_kernel(),
+							  gfx::emboss_kernel(),
+							  gfx::laplacian_kernel() };
+		for (auto& kernel : kernels) {
+		  for (int policy = 0; policy < 4; ++policy) {
+		    gfx::true_color_image after;
+		    convolve(after, before.view(30, 20, 40, 30), kernel, gfx::border_policy(policy), gfx::OLIVE);
+		    gfx::true_color_image region(before.view(30, 20, 40, 30));
+		    for (int y = 0; y < region.height(); ++y) {
+		      for (int x = 0; x < region.width(); ++x) {
+			for (int c = 0; c < 3; ++c) {
+			  int sum = 0;
+			  for (int i = 0; i < 3; ++i) {
+			    for (int j = 0; j < 3; ++j) {
+			      const gfx::true_color_rgb* pixel = &gfx::OLIVE;
+			      int sx, sy;
+			      switch (policy) {
+			      case gfx::BORDER_CLAMP:
+				sx = gfx::border_index<gfx::BORDER_CLAMP>(x + j - 1, region.width());
+				sy = gfx::border_index<gfx::BORDER_CLAMP>(y + i - 1, region.height());
+				break;
+			      case gfx::BORDER_MIRROR:
+				sx = gfx::border_index<gfx::BORDER_MIRROR>(x + j - 1, region.width());
+				sy = gfx::border_index<gfx::BORDER_MIRROR>(y + i - 1, region.height());
+				break;
+			      case gfx::BORDER_WRAP:
+				sx = gfx::border_index<gfx::BORDER_WRAP>(x + j - 1, region.width());
+				sy = gfx::border_index<gfx::BORDER_WRAP>(y + i - 1, region.height());
+				break;
+			      default:
+				sx = gfx::border_index<gfx::BORDER_CONSTANT>(x + j - 1, region.width());
+				sy = gfx::border_index<gfx::BORDER_CONSTANT>(y + i - 1, region.height());
+			      }
+			      if ((sx >= 0) && (sy >= 0)) {
+				pixel = &region.pixel(sx, sy);
+			      }
+			      sum += int(kernel[i][j]) * (*pixel)[c];
+			    }
+			  }
+			  TEST_EQUAL("convolve : integer kernel",
+				     std::min(std::max(sum, 0), 255),
+				     after.pixel(x, y)[c]);
+			}
+		      }
+		    }
+		  }
+		}
+
+		// a normalized 3x3 box kernel matches box_blur, up to rounding
+		const float ninth = 1.0f / 9.0f;
+		gfx::matrix3x3<float> box({ninth, ninth, ninth, ninth, ninth, ninth, ninth, ninth, ninth});
+		gfx::true_color_image blurred = gfx::box_blur(before, 1),
+		  convolved = gfx::convolve(before, box);
+		TEST_TRUE("convolve : box kernel", convolved.almost_equal(blurred, 1));
+		TEST_TRUE("convolve : box kernel", blurred.almost_equal(convolved, 1));
+		gfx::hdr_image hdr_blurred = gfx::box_blur(hdr_before, 1),
+		  hdr_convolved = gfx::convolve(hdr_before, box);
+		TEST_TRUE("convolve : box kernel<hdr_color_depth>", hdr_convolved.almost_equal(hdr_blurred, .0001));
+	      });
+
+  r.criterion("separable convolution",
+	      1,
+	      [&]() {
+		gfx::true_color_image before;
+		TEST_TRUE("separable convolution : load before image",
+			  gfx::ppm_read(before, binary_ppm_path));
+		gfx::hdr_image hdr_before;
+		before.convert_to(hdr_before);
+
+		// rank detection
+		gfx::vector<float, 3> row3;
+		gfx::vector<float, 3> column3;
+		TEST_FALSE("separable convolution : sharpen is not separable",
+			   gfx::separate_kernel(gfx::sharpen_kernel(), row3, column3));
+		TEST_FALSE("separable convolution : laplacian is not separable",
+			   gfx::separate_kernel(gfx::laplacian_kernel(), row3, column3));
+		TEST_FALSE("separable convolution : zero kernel is not separable",
+			   gfx::separate_kernel(gfx::matrix3x3<float>({0, 0, 0, 0, 0, 0, 0, 0, 0}), row3, column3));
+		gfx::matrix3x3<float> sobel({-1, 0, 1, -2, 0, 2, -1, 0, 1});
+		TEST_TRUE("separable convolution : sobel is separable",
+			  gfx::separate_kernel(sobel, row3, column3));
+		for (int i = 0; i < 3; ++i) {
+		  for (int j = 0; j < 3; ++j) {
+		    TEST_EQUAL("separable convolution : sobel factors",
+			       sobel[i][j], column3[i] * row3[j]);
+		  }
+		}
+
+		// a 5x5 binomial kernel, as factors and as a full matrix
+		const float binomial[5] = {1 / 16.0f, 4 / 16.0f, 6 / 16.0f, 4 / 16.0f, 1 / 16.0f};
+		gfx::vector<float, 5> row5;
+		gfx::vector<float, 5> column5;
+		gfx::matrix<float, 5, 5> kernel5({0});
+		for (int i = 0; i < 5; ++i) {
+		  row5[i] = column5[i] = binomial[i];
+		  for (int j = 0; j < 5; ++j) {
+		    kernel5[i][j] = binomial[i] * binomial[j];
+		  }
+		}
+		gfx::vector<float, 5> detected_row;
+		gfx::vector<float, 5> detected_column;
+		TEST_TRUE("separable convolution : binomial is separable",
+			  gfx::separate_kernel(kernel5, detected_row, detected_column));
+
+		// the separable path is identical to the 2-D path for exactly representable factors
+		for (int policy = 0; policy < 4; ++policy) {
+		  gfx::true_color_image separable, direct;
+		  gfx::convolve_separable(separable, before.view(10, 10, 50, 40), row5, column5,
+					  gfx::border_policy(policy), gfx::OLIVE);
+		  switch (policy) {
+		  case gfx::BORDER_CLAMP:
+		    gfx::convolve_with_border<gfx::BORDER_CLAMP>(direct, before.view(10, 10, 50, 40), kernel5, gfx::OLIVE);
+		    break;
+		  case gfx::BORDER_MIRROR:
+		    gfx::convolve_with_border<gfx::BORDER_MIRROR>(direct, before.view(10, 10, 50, 40), kernel5, gfx::OLIVE);
+		    break;
+		  case gfx::BORDER_WRAP:
+		    gfx::convolve_with_border<gfx::BORDER_WRAP>(direct, before.view(10, 10, 50, 40), kernel5, gfx::OLIVE);
+		    break;
+		  default:
+		    gfx::convolve_with_border<gfx::BORDER_CONSTANT>(direct, before.view(10, 10, 50, 40), kernel5, gfx::OLIVE);
+		  }
+		  TEST_EQUAL("separable convolution : matches 2-D convolution", direct, separable);
+
+		  // and convolve picks the separable path without changing the result
+		  gfx::true_color_image automatic;
+		  gfx::convolve(automatic, before.view(10, 10, 50, 40), kernel5,
+				gfx::border_policy(policy), gfx::OLIVE);
+		  TEST_EQUAL("separable convolution : automatic detection", direct, automatic);
+		}
+
+		// a kernel with negative weights, whose fixed-point check
+		// multiplies negative weights
+		gfx::matrix3x3<float> sobel_x({-1, 0, 1, -2, 0, 2, -1, 0, 1});
+		gfx::true_color_image sobel_direct;
+		gfx::convolve_with_border<gfx::BORDER_CLAMP>(sobel_direct, before, sobel_x);
+		TEST_EQUAL("separable convolution : signed kernel", sobel_direct, gfx::convolve(before, sobel_x));
+
+		// a rectangular kernel, and floating point components
+		gfx::vector<float, 3> row_box({1 / 3.0f, 1 / 3.0f, 1 / 3.0f});
+		gfx::vector<float, 1> column_identity({1});
+		TEST_EQUAL("separable convolution : 3x1",
+			   gfx::convolve(before, gfx::matrix<float, 1, 3>({1 / 3.0f, 1 / 3.0f, 1 / 3.0f})),
+			   gfx::convolve_separable(before, row_box, column_identity));
+		gfx::hdr_image hdr_separable = gfx::convolve_separable(hdr_before, row5, column5),
+		  hdr_direct;
+		gfx::convolve_with_border<gfx::BORDER_CLAMP>(hdr_direct, hdr_before, kernel5);
+		TEST_TRUE("separable convolution<hdr_color_depth>", hdr_separable.almost_equal(hdr_direct, .0001));
+		TEST_TRUE("separable convolution<hdr_color_depth>", hdr_direct.almost_equal(hdr_separable, .0001));
+	      });
+
+  r.criterion("binary ppm_read",
+	      1,
+	      [&]() {
+		const std::string temp_path("temp.ppm");
+		gfx::true_color_image image;
+
+		// one-byte samples with maxval < 255 are rescaled
+		{
+		  std::ofstream f(temp_path, std::ios_base::binary);
+		  f << "P6\n# comment\n2 1\n100\n";
+		  const unsigned char samples[] = {0, 50, 100, 1, 99, 3};
+		  f.write((const char*) samples, sizeof(samples));
+		}
+		TEST_TRUE("binary ppm_read : maxval 100", gfx::ppm_read(image, temp_path));
+		TEST_EQUAL("binary ppm_read : maxval 100", 2, image.width());
+		TEST_EQUAL("binary ppm_read : maxval 100", 1, image.height());
+		TEST_EQUAL("binary ppm_read : maxval 100", gfx::true_color_rgb(0, 127, 255), image.pixel(0, 0));
+		TEST_EQUAL("binary ppm_read : maxval 100", gfx::true_color_rgb(2, 252, 7), image.pixel(1, 0));
+
+		// two-byte samples, most-significant byte first
+		{
+		  std::ofstream f(temp_path, std::ios_base::binary);
+		  f << "P6 1 2 1000\n";
+		  const unsigned char samples[] = {0, 0, 0x01, 0xF4, 0x03, 0xE8,
+						   0x03, 0xE7, 0, 1, 0, 4};
+		  f.write((const char*) samples, sizeof(samples));
+		}
+		TEST_TRUE("binary ppm_read : maxval 1000", gfx::ppm_read(image, temp_path));
+		TEST_EQUAL("binary ppm_read : maxval 1000", gfx::true_color_rgb(0, 127, 255), image.pixel(0, 0));
+		TEST_EQUAL("binary ppm_read : maxval 1000", gfx::true_color_rgb(254, 0, 1), image.pixel(0, 1));
+
+		// samples greater than maxval are malformed
+		{
+		  std::ofstream f(temp_path, std::ios_base::binary);
+		  f << "P6 1 1 100\n";
+		  const unsigned char samples[] = {0, 101, 0};
+		  f.write((const char*) samples, sizeof(samples));
+		}
+		TEST_FALSE("binary ppm_read : sample > maxval", gfx::ppm_read(image, temp_path));
+		TEST_TRUE("binary ppm_read : sample > maxval", image.empty());
+
+		// a truncated payload is an I/O error
+		{
+		  std::ofstream f(temp_path, std::ios_base::binary);
+		  f << "P6 2 2 255\n";
+		  const unsigned char samples[] = {1, 2, 3, 4, 5, 6, 7};
+		  f.write((const char*) samples, sizeof(samples));
+		}
+		TEST_FALSE("binary ppm_read : truncated", gfx::ppm_read(image, temp_path));
+		TEST_TRUE("binary ppm_read : truncated", image.empty());
+		remove(temp_path.c_str());
+	      });
+
+  r.criterion("bulk ppm_write",
+	      1,
+	      [&]() {
+		gfx::true_color_image before;
+		TEST_TRUE("bulk ppm_write : load before image",
+			  gfx::ppm_read(before, binary_ppm_path));
+		const std::string temp_path("temp.ppm");
+
+		// a non-contiguous view is written row by row
+		gfx::true_color_view region = before.view(7, 3, 61, 47);
+		TEST_FALSE("bulk ppm_write : view", region.is_contiguous());
+		for (int binary = 0; binary < 2; ++binary) {
+		  gfx::true_color_image after;
+		  TEST_TRUE("bulk ppm_write : view", gfx::ppm_write(region, temp_path, binary));
+		  TEST_TRUE("bulk ppm_write : view", gfx::ppm_read(after, temp_path));
+		  TEST_EQUAL("bulk ppm_write : view", gfx::true_color_image(region), after);
+		}
+
+		// text output exercises every sample value, one pixel per line
+		gfx::true_color_image ramp(256, 1);
+		for (int x = 0; x < 256; ++x) {
+		  ramp.pixel(x, 0).assign(x, 255 - x, x % 10);
+		}
+		TEST_TRUE("bulk ppm_write : text", gfx::ppm_write(ramp, temp_path, false));
+		{
+		  std::ifstream f(temp_path);
+		  std::string line;
+		  std::getline(f, line);
+		  TEST_EQUAL("bulk ppm_write : text header", "P3 256 1 255", line);
+		  std::getline(f, line);
+		  TEST_EQUAL("bulk ppm_write : text pixel", " 0 255 0", line);
+		  int lines = 2;
+		  while (std::getline(f, line)) {
+		    TEST_LE("bulk ppm_write : text line length", line.size(), 70);
+		    ++lines;
+		  }
+		  TEST_EQUAL("bulk ppm_write : text lines", 1 + 256, lines);
+		}
+		gfx::true_color_image after;
+		TEST_TRUE("bulk ppm_write : text", gfx::ppm_read(after, temp_path));
+		TEST_EQUAL("bulk ppm_write : text", ramp, after);
+		remove(temp_path.c_str());
+	      });
+
+  r.criterion("mapped_ppm",
+	      1,
+	      [&]() {
+		gfx::true_color_image before;
+		TEST_TRUE("mapped_ppm : load before image",
+			  gfx::ppm_read(before, binary_ppm_path));
+
+		gfx::mapped_ppm mapped(binary_ppm_path);
+		TEST_FALSE("mapped_ppm : open", mapped.empty());
+		TEST_EQUAL("mapped_ppm : width", before.width(), mapped.width());
+		TEST_EQUAL("mapped_ppm : height", before.height(), mapped.height());
+		TEST_EQUAL("mapped_ppm : pixels", before, gfx::true_color_image(mapped.view()));
+		TEST_EQUAL("mapped_ppm : pixel", before.pixel(17, 23), mapped.pixel(17, 23));
+
+		// filters accept a mapped_ppm as input
+		TEST_EQUAL("mapped_ppm : filter input", gfx::grayscale(before), gfx::grayscale(mapped));
+		gfx::true_color_image after;
+		gfx::box_blur(after, mapped, 2);
+		TEST_EQUAL("mapped_ppm : filter input", gfx::box_blur(before, 2), after);
+
+		// moving transfers the mapping
+		gfx::mapped_ppm moved(std::move(mapped));
+		TEST_TRUE("mapped_ppm : move", mapped.empty());
+		TEST_EQUAL("mapped_ppm : move", before, gfx::true_color_image(moved.view()));
+		moved.close();
+		TEST_TRUE("mapped_ppm : close", moved.empty());
+
+		// only P6 files with maxval 255 can be mapped
+		TEST_FALSE("mapped_ppm : ASCII", moved.open(ascii_ppm_path));
+		TEST_TRUE("mapped_ppm : ASCII", moved.empty());
+		TEST_FALSE("mapped_ppm : missing file", moved.open("no_such_file.ppm"));
+		const std::string temp_path("temp.ppm");
+		{
+		  std::ofstream f(temp_path, std::ios_base::binary);
+		  f << "P6 2 2 100\n";
+		  const unsigned char samples[12] = {0};
+		  f.write((const char*) samples, sizeof(samples));
+		}
+		TEST_FALSE("mapped_ppm : maxval 100", moved.open(temp_path));
+		{
+		  std::ofstream f(temp_path, std::ios_base::binary);
+		  f << "P6 2 2 255\n";
+		  const unsigned char samples[11] = {0};
+		  f.write((const char*) samples, sizeof(samples));
+		}
+		TEST_FALSE("mapped_ppm : truncated", moved.open(temp_path));
+		remove(temp_path.c_str());
+	      });
+
+  r.criterion("text ppm_read",
+	      1,
+	      [&]() {
+		const std::string temp_path("temp.ppm");
+		gfx::true_color_image image;
+		auto write_temp = [&](const std::string& contents) {
+		  std::ofstream f(temp_path, std::ios_base::binary);
+		  f << contents;
+		};
+
+		// comments, assorted whitespace, leading zeros, and a final
+		// sample with no trailing newline
+		write_temp("P3\n# comment\n3 1\n255\n"
+			   "  0 00255 12#comment 42\n99\t7\r\n"
+			   "000000000128\v1 2\f3");
+		TEST_TRUE("text ppm_read : format", gfx::ppm_read(image, temp_path));
+		TEST_EQUAL("text ppm_read : format", gfx::true_color_rgb(0, 255, 12), image.pixel(0, 0));
+		TEST_EQUAL("text ppm_read : format", gfx::true_color_rgb(99, 7, 128), image.pixel(1, 0));
+		TEST_EQUAL("text ppm_read : format", gfx::true_color_rgb(1, 2, 3), image.pixel(2, 0));
+
+		// samples are rescaled from maxval
+		write_temp("P3 2 1 1000 0 500 1000 999 1 4");
+		TEST_TRUE("text ppm_read : maxval 1000", gfx::ppm_read(image, temp_path));
+		TEST_EQUAL("text ppm_read : maxval 1000", gfx::true_color_rgb(0, 127, 255), image.pixel(0, 0));
+		TEST_EQUAL("text ppm_read : maxval 1000", gfx::true_color_rgb(254, 0, 1), image.pixel(1, 0));
+
+		// malformed input
+		const char* malformed[] = { "P3 1 1 255 1 2 x",
+					    "P3 1 1 255 1 -2 3",
+					    "P3 1 1 255 1 256 3",
+					    "P3 1 1 100 1 101 3",
+					    "P3 1 1 255 0000000000000000256 0 0",
+					    "P3 1 1 255 1 2",
+					    "P3 1 1 255 1 2 # 3" };
+		for (auto contents : malformed) {
+		  write_temp(contents);
+		  TEST_FALSE("text ppm_read : malformed", gfx::ppm_read(image, temp_path));
+		  TEST_TRUE("text ppm_read : malformed", image.empty());
+		}
+
+		// payloads long enough to be scanned in whole blocks, with
+		// samples of 1 to 11 digits and every kind of whitespace
+		// falling across block boundaries
+		const char* separators[] = { " ", "\n", "\t\t", "  \r\n", "\v", "\f " };
+		std::vector<std::string> samples;
+		gfx::true_color_image expected(100, 1);
+		for (int i = 0; i < 300; ++i) {
+		  const int sample = (i * 37) % 256;
+		  expected.pixel(i / 3, 0)[i % 3] = sample;
+		  samples.push_back(std::string(i % 9, '0') + std::to_string(sample) + separators[i % 6]);
+		}
+		auto payload = [&](int i, const std::string& replacement) {
+		  std::string contents("P3 100 1 255\n");
+		  for (int j = 0; j < int(samples.size()); ++j) {
+		    contents += (j == i) ? replacement : samples[j];
+		  }
+		  return contents;
+		};
+		write_temp(payload(-1, ""));
+		TEST_TRUE("text ppm_read : blocks", gfx::ppm_read(image, temp_path));
+		TEST_EQUAL("text ppm_read : blocks", expected, image);
+		write_temp(payload(150, samples[150] + "# 256 x\n"));
+		TEST_TRUE("text ppm_read : blocks", gfx::ppm_read(image, temp_path));
+		TEST_EQUAL("text ppm_read : blocks", expected, image);
+		const std::string bad_blocks[] = { "256 ", "1x ", "0000000000000256 " };
+		for (auto replacement : bad_blocks) {
+		  for (int i : { 1, 100, 250 }) {
+		    write_temp(payload(i, replacement));
+		    TEST_FALSE("text ppm_read : blocks", gfx::ppm_read(image, temp_path));
+		  }
+		}
+
+		// a payload spanning many read buffers
+		gfx::true_color_image noise(300, 200);
+		for (int y = 0; y < noise.height(); ++y) {
+		  for (int x = 0; x < noise.width(); ++x) {
+		    noise.pixel(x, y).assign((x * 7 + y) % 256, (x * y) % 256, (x + y * 13) % 256);
+		  }
+		}
+		TEST_TRUE("text ppm_read : large", gfx::ppm_write(noise, temp_path, false));
+		TEST_TRUE("text ppm_read : large", gfx::ppm_read(image, temp_path));
+		TEST_EQUAL("text ppm_read : large", noise, image);
+		remove(temp_path.c_str());
+	      });
+
+  r.criterion("ppm_row_reader, ppm_row_writer",
+	      1,
+	      [&]() {
+		gfx::true_color_image before;
+		TEST_TRUE("ppm_row_reader : load before image",
+			  gfx::ppm_read(before, binary_ppm_path));
+		const std::string temp_path("temp.ppm");
+
+		// stream grayscale through row by row, from both file kinds
+		// and to both file kinds
+		const std::string paths[] = { binary_ppm_path, ascii_ppm_path };
+		for (auto& path : paths) {
+		  for (int binary = 0; binary < 2; ++binary) {
+		    gfx::ppm_row_reader reader(path);
+		    TEST_FALSE("ppm_row_reader : open", reader.failed());
+		    TEST_EQUAL("ppm_row_reader : width", before.width(), reader.width());
+		    TEST_EQUAL("ppm_row_reader : height", before.height(), reader.height());
+		    gfx::ppm_row_writer writer(temp_path, reader.width(), reader.height(), binary);
+		    TEST_FALSE("ppm_row_writer : open", writer.failed());
+		    gfx::true_color_image row, filtered;
+		    while (reader.read_row(row)) {
+		      TEST_EQUAL("ppm_row_reader : row", before.width(), row.width());
+		      TEST_EQUAL("ppm_row_reader : row", 1, row.height());
+		      grayscale(filtered, row);
+		      TEST_TRUE("ppm_row_writer : write_row", writer.write_row(filtered));
+		    }
+		    TEST_TRUE("ppm_row_reader : done", reader.done());
+		    TEST_FALSE("ppm_row_reader : past the end", reader.read_row(row));
+		    TEST_FALSE("ppm_row_writer : past the end", writer.write_row(filtered));
+		    TEST_TRUE("ppm_row_writer : close", writer.close());
+
+		    gfx::true_color_image after;
+		    TEST_TRUE("ppm_row_writer : read back", gfx::ppm_read(after, temp_path));
+		    TEST_EQUAL("ppm_row_writer : read back", gfx::grayscale(before), after);
+		  }
+		}
+
+		// too few rows
+		{
+		  gfx::ppm_row_writer writer(temp_path, 2, 2);
+		  gfx::true_color_image row(2, 1);
+		  row.fill(gfx::RED);
+		  TEST_TRUE("ppm_row_writer : write_row", writer.write_row(row));
+		  TEST_FALSE("ppm_row_writer : too few rows", writer.close());
+		}
+
+		// a truncated file fails on the row that is cut short
+		{
+		  gfx::ppm_row_reader reader(temp_path);
+		  gfx::true_color_image row;
+		  TEST_TRUE("ppm_row_reader : truncated", reader.read_row(row));
+		  TEST_EQUAL("ppm_row_reader : truncated", gfx::RED, row.pixel(1, 0));
+		  TEST_FALSE("ppm_row_reader : truncated", reader.read_row(row));
+		  TEST_TRUE("ppm_row_reader : truncated", reader.failed());
+		  TEST_FALSE("ppm_row_reader : truncated", reader.done());
+		}
+
+		TEST_TRUE("ppm_row_reader : missing file", gfx::ppm_row_reader("no_such_file.ppm").failed());
+		remove(temp_path.c_str());
+	      });
+
+  r.criterion("16-bit ppm",
+	      1,
+	      [&]() {
+		const std::string temp_path("temp.ppm");
+
+		// 8-bit files read into HDR images
+		gfx::true_color_image before;
+		TEST_TRUE("16-bit ppm : load before image",
+			  gfx::ppm_read(before, binary_ppm_path));
+		gfx::hdr_image expected, hdr;
+		before.convert_to(expected);
+		TEST_TRUE("16-bit ppm : 8-bit binary", gfx::ppm_read(hdr, binary_ppm_path));
+		TEST_TRUE("16-bit ppm : 8-bit binary", hdr.almost_equal(expected, 1e-6));
+		TEST_TRUE("16-bit ppm : 8-bit binary", expected.almost_equal(hdr, 1e-6));
+		TEST_TRUE("16-bit ppm : 8-bit text", gfx::ppm_read(hdr, ascii_ppm_path));
+		TEST_TRUE("16-bit ppm : 8-bit text", hdr.almost_equal(expected, 1e-6));
+		TEST_TRUE("16-bit ppm : 8-bit text", expected.almost_equal(hdr, 1e-6));
+
+		// a hand-made 16-bit file keeps every bit
+		{
+		  std::ofstream f(temp_path, std::ios_base::binary);
+		  f << "P6 2 1 65535\n";
+		  const unsigned char samples[] = {0x00, 0x00, 0x00, 0x01, 0x12, 0x34,
+						   0xAB, 0xCD, 0xFF, 0xFE, 0xFF, 0xFF};
+		  f.write((const char*) samples, sizeof(samples));
+		}
+		TEST_TRUE("16-bit ppm : read", gfx::ppm_read(hdr, temp_path));
+		const int raw[] = {0x0000, 0x0001, 0x1234, 0xABCD, 0xFFFE, 0xFFFF};
+		for (int i = 0; i < 6; ++i) {
+		  TEST_EQUAL("16-bit ppm : read", raw[i] / 65535.0f, hdr.pixel(i / 3, 0)[i % 3]);
+		}
+		gfx::true_color_image narrow;
+		TEST_TRUE("16-bit ppm : read true color", gfx::ppm_read(narrow, temp_path));
+		TEST_EQUAL("16-bit ppm : read true color", gfx::true_color_rgb(0, 0, 18), narrow.pixel(0, 0));
+
+		// HDR round trips through both file kinds, clamping out-of-range components
+		gfx::hdr_image original(37, 11);
+		for (int y = 0; y < original.height(); ++y) {
+		  for (int x = 0; x < original.width(); ++x) {
+		    original.pixel(x, y).assign((x * 1777 + y * 31) / 65535.0f,
+						(x * y * 97) / 65535.0f,
+						(65535 - x * 13) / 65535.0f);
+		  }
+		}
+		gfx::hdr_image unclamped(original);
+		unclamped.pixel(0, 0)[0] = -0.5;
+		unclamped.pixel(0, 0)[1] = 2.0;
+		unclamped.pixel(0, 0)[2] = 1.0;
+		original.pixel(0, 0).assign(0.0, 1.0, 1.0);
+		for (int binary = 0; binary < 2; ++binary) {
+		  TEST_TRUE("16-bit ppm : write", gfx::ppm_write(unclamped, temp_path, binary));
+		  {
+		    std::ifstream f(temp_path, std::ios_base::binary);
+		    std::string magic;
+		    int width, height, maxval;
+		    f >> magic >> width >> height >> maxval;
+		    TEST_EQUAL("16-bit ppm : write maxval", 65535, maxval);
+		  }
+		  TEST_TRUE("16-bit ppm : round trip", gfx::ppm_read(hdr, temp_path));
+		  TEST_EQUAL("16-bit ppm : round trip", original, hdr);
+		}
+
+		// views are written too
+		TEST_TRUE("16-bit ppm : view", gfx::ppm_write(original.view(3, 2, 20, 5), temp_path));
+		TEST_TRUE("16-bit ppm : view", gfx::ppm_read(hdr, temp_path));
+		TEST_EQUAL("16-bit ppm : view", gfx::hdr_image(original.view(3, 2, 20, 5)), hdr);
+		remove(temp_path.c_str());
+	      });
+
+  r.criterion("ppm_stream_reader, ppm_stream_writer",
+	      1,
+	      [&]() {
+		gfx::true_color_image before;
+		TEST_TRUE("ppm_stream : load before image",
+			  gfx::ppm_read(before, binary_ppm_path));
+		gfx::hdr_image hdr_before;
+		before.convert_to(hdr_before);
+		const std::string temp_path("temp.ppm");
+
+		// several frames of varying size and depth in one file
+		{
+		  int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		  TEST_TRUE("ppm_stream_writer : open", fd >= 0);
+		  gfx::ppm_stream_writer writer(fd);
+		  TEST_TRUE("ppm_stream_writer : frame", writer.write_frame(before));
+		  TEST_TRUE("ppm_stream_writer : frame", writer.write_frame(before.view(10, 20, 30, 40)));
+		  TEST_TRUE("ppm_stream_writer : frame", writer.write_frame(hdr_before));
+		  TEST_TRUE("ppm_stream_writer : frame", writer.write_frame(gfx::grayscale(before)));
+		  TEST_EQUAL("ppm_stream_writer : frames", 4, writer.frames());
+		  TEST_FALSE("ppm_stream_writer : failed", writer.failed());
+		  close(fd);
+		}
+		{
+		  int fd = open(temp_path.c_str(), O_RDONLY);
+		  TEST_TRUE("ppm_stream_reader : open", fd >= 0);
+		  gfx::ppm_stream_reader reader(fd);
+		  gfx::true_color_image frame;
+		  gfx::hdr_image hdr_frame;
+		  TEST_TRUE("ppm_stream_reader : frame 0", reader.read_frame(frame));
+		  TEST_EQUAL("ppm_stream_reader : frame 0", before, frame);
+		  TEST_TRUE("ppm_stream_reader : frame 1", reader.read_frame(frame));
+		  TEST_EQUAL("ppm_stream_reader : frame 1", gfx::true_color_image(before.view(10, 20, 30, 40)), frame);
+		  TEST_TRUE("ppm_stream_reader : frame 2", reader.read_frame(hdr_frame));
+		  TEST_TRUE("ppm_stream_reader : frame 2", hdr_frame.almost_equal(hdr_before, 1e-6));
+		  TEST_TRUE("ppm_stream_reader : frame 2", hdr_before.almost_equal(hdr_frame, 1e-6));
+		  // reading the same size again reuses the storage
+		  frame.resize(before.width(), before.height());
+		  const gfx::true_color_rgb* storage = frame.data();
+		  TEST_TRUE("ppm_stream_reader : frame 3", reader.read_frame(frame));
+		  TEST_EQUAL("ppm_stream_reader : frame 3", gfx::grayscale(before), frame);
+		  TEST_EQUAL("ppm_stream_reader : frame 3 storage", storage, frame.data());
+		  TEST_FALSE("ppm_stream_reader : end", reader.read_frame(frame));
+		  TEST_FALSE("ppm_stream_reader : end", reader.failed());
+		  TEST_EQUAL("ppm_stream_reader : frames", 4, reader.frames());
+		  close(fd);
+		}
+
+		// after the first frame of a size, frames are read and written
+		// without allocating, at either depth
+		{
+		  int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		  gfx::ppm_stream_writer writer(fd);
+		  writer.write_frame(hdr_before);
+		  std::size_t allocations = allocation_count;
+		  writer.write_frame(hdr_before);
+		  writer.write_frame(hdr_before);
+		  TEST_EQUAL("ppm_stream_writer : HDR allocations", 0, allocation_count - allocations);
+		  writer.write_frame(before);
+		  allocations = allocation_count;
+		  writer.write_frame(before);
+		  writer.write_frame(before);
+		  TEST_EQUAL("ppm_stream_writer : allocations", 0, allocation_count - allocations);
+		  close(fd);
+		}
+		for (int as_hdr = 0; as_hdr < 2; ++as_hdr) {
+		  int fd = open(temp_path.c_str(), O_RDONLY);
+		  gfx::ppm_stream_reader reader(fd);
+		  gfx::true_color_image frame;
+		  gfx::hdr_image hdr_frame;
+		  auto read = [&]() { return as_hdr ? reader.read_frame(hdr_frame) : reader.read_frame(frame); };
+		  // three 16-bit frames, then three 8-bit ones
+		  for (int part = 0; part < 2; ++part) {
+		    TEST_TRUE("ppm_stream_reader : reuse", read());
+		    std::size_t allocations = allocation_count;
+		    TEST_TRUE("ppm_stream_reader : reuse", read());
+		    TEST_TRUE("ppm_stream_reader : reuse", read());
+		    TEST_EQUAL("ppm_stream_reader : allocations", 0, allocation_count - allocations);
+		  }
+		  close(fd);
+		}
+
+		// through a pipe
+		{
+		  int fds[2];
+		  TEST_EQUAL("ppm_stream : pipe", 0, pipe(fds));
+		  gfx::true_color_image small(before.view(0, 0, 20, 10));
+		  {
+		    gfx::ppm_stream_writer writer(fds[1]);
+		    TEST_TRUE("ppm_stream : pipe", writer.write_frame(small));
+		    TEST_TRUE("ppm_stream : pipe", writer.write_frame(small));
+		  }
+		  close(fds[1]);
+		  gfx::ppm_stream_reader reader(fds[0]);
+		  gfx::true_color_image frame;
+		  int frames = 0;
+		  while (reader.read_frame(frame)) {
+		    TEST_EQUAL("ppm_stream : pipe", small, frame);
+		    ++frames;
+		  }
+		  TEST_EQUAL("ppm_stream : pipe", 2, frames);
+		  TEST_FALSE("ppm_stream : pipe", reader.failed());
+		  close(fds[0]);
+		}
+
+		// a truncated frame, and a textual frame, are failures
+		const char* malformed[] = { "P6 2 1 255\n\x01\x02\x03\x04\x05",
+					    "P3 1 1 255\n1 2 3\n" };
+		for (auto contents : malformed) {
+		  {
+		    std::ofstream f(temp_path, std::ios_base::binary);
+		    f << contents;
+		  }
+		  int fd = open(temp_path.c_str(), O_RDONLY);
+		  gfx::ppm_stream_reader reader(fd);
+		  gfx::true_color_image frame;
+		  TEST_FALSE("ppm_stream_reader : malformed", reader.read_frame(frame));
+		  TEST_TRUE("ppm_stream_reader : malformed", reader.failed());
+		  TEST_TRUE("ppm_stream_reader : malformed", frame.empty());
+		  close(fd);
+		}
+		remove(temp_path.c_str());
+	      });
+
+  r.criterion("async_ppm_loader",
+	      1,
+	      [&]() {
+		gfx::true_color_image before, from_ascii;
+		TEST_TRUE("async_ppm_loader : load before image",
+			  gfx::ppm_read(before, binary_ppm_path));
+		TEST_TRUE("async_ppm_loader : load before image",
+			  gfx::ppm_read(from_ascii, ascii_ppm_path));
+
+		// a mix of file kinds, sizes, and a missing file, in order
+		std::vector<std::string> paths;
+		std::vector<gfx::true_color_image> expected;
+		for (int i = 0; i < 5; ++i) {
+		  paths.push_back(binary_ppm_path);
+		  expected.push_back(before);
+		  paths.push_back(ascii_ppm_path);
+		  expected.push_back(from_ascii);
+		  paths.push_back(pattern_box_blur_before_ppm_path);
+		  expected.push_back(gfx::true_color_image());
+		  gfx::ppm_read(expected.back(), pattern_box_blur_before_ppm_path);
+		}
+		paths.insert(paths.begin() + 4, "no_such_file.ppm");
+		expected.insert(expected.begin() + 4, gfx::true_color_image());
+
+		for (int capacity = 1; capacity <= 3; ++capacity) {
+		  for (int threads = 1; threads <= 3; ++threads) {
+		    gfx::async_ppm_loader loader(paths, capacity, threads);
+		    TEST_EQUAL("async_ppm_loader : size", paths.size(), loader.size());
+		    gfx::true_color_image image;
+		    std::size_t count = 0;
+		    while (loader.next(image)) {
+		      TEST_EQUAL("async_ppm_loader : image", expected[count], image);
+		      ++count;
+		      TEST_EQUAL("async_ppm_loader : delivered", count, loader.delivered());
+		    }
+		    TEST_EQUAL("async_ppm_loader : count", paths.size(), count);
+		    TEST_FALSE("async_ppm_loader : end", loader.next(image));
+		  }
+		}
+
+		// destroying a loader before it is drained stops it
+		{
+		  gfx::async_ppm_loader loader(paths, 2, 2);
+		  gfx::true_color_image image;
+		  TEST_TRUE("async_ppm_loader : abandon", loader.next(image));
+		}
+		{
+		  gfx::async_ppm_loader loader(std::vector<std::string>(), 2, 2);
+		  gfx::true_color_image image;
+		  TEST_FALSE("async_ppm_loader : no paths", loader.next(image));
+		}
+	      });
+
+  r.criterion("ppm_probe",
+	      1,
+	      [&]() {
+		gfx::true_color_image before;
+		TEST_TRUE("ppm_probe : load before image",
+			  gfx::ppm_read(before, binary_ppm_path));
+
+		gfx::ppm_header header;
+		TEST_TRUE("ppm_probe : binary", gfx::ppm_probe(binary_ppm_path, header));
+		TEST_EQUAL("ppm_probe : binary", before.width(), header.width);
+		TEST_EQUAL("ppm_probe : binary", before.height(), header.height);
+		TEST_EQUAL("ppm_probe : binary", 255, header.maxval);
+		TEST_TRUE("ppm_probe : binary", header.binary_samples);
+		{
+		  std::ifstream f(binary_ppm_path, std::ios_base::binary | std::ios_base::ate);
+		  std::streamoff size = f.tellg();
+		  TEST_EQUAL("ppm_probe : payload offset",
+			     size - 3 * before.width() * before.height(),
+			     header.payload_offset);
+		}
+
+		TEST_TRUE("ppm_probe : text", gfx::ppm_probe(ascii_ppm_path, header));
+		TEST_EQUAL("ppm_probe : text", before.width(), header.width);
+		TEST_EQUAL("ppm_probe : text", before.height(), header.height);
+		TEST_FALSE("ppm_probe : text", header.binary_samples);
+
+		// comments, and a payload that is never looked at
+		const std::string temp_path("temp.ppm");
+		{
+		  std::ofstream f(temp_path, std::ios_base::binary);
+		  f << "P6\n# a comment\n640 # another\n480\n65535\ngarbage";
+		}
+		TEST_TRUE("ppm_probe : comments", gfx::ppm_probe(temp_path, header));
+		TEST_EQUAL("ppm_probe : comments", 640, header.width);
+		TEST_EQUAL("ppm_probe : comments", 480, header.height);
+		TEST_EQUAL("ppm_probe : comments", 65535, header.maxval);
+		TEST_EQUAL("ppm_probe : comments", 39, header.payload_offset);
+		gfx::true_color_image image;
+		TEST_FALSE("ppm_probe : ppm_read agrees the payload is bad", gfx::ppm_read(image, temp_path));
+
+		// invalid headers
+		const char* invalid[] = { "P5 1 1 255\n", "P6 0 1 255\n", "P6 1 1 65536\n", "P6 1 1 255" };
+		for (auto contents : invalid) {
+		  {
+		    std::ofstream f(temp_path, std::ios_base::binary);
+		    f << contents;
+		  }
+		  TEST_FALSE("ppm_probe : invalid", gfx::ppm_probe(temp_path, header));
+		}
+		TEST_FALSE("ppm_probe : missing file", gfx::ppm_probe("no_such_file.ppm", header));
+		remove(temp_path.c_str());
+	      });
+
+  r.criterion("parallel text ppm parsing",
+	      1,
+	      [&]() {
+		// text with comments, assorted line endings, and numbers of
+		// every length
+		std::string text;
+		std::vector<uint8_t> expected;
+		for (int i = 0; i < 3000; ++i) {
+		  int sample = (i * 7919) % 256;
+		  if (i % 97 == 0) {
+		    text += "# comment 1 2 3\n";
+		  }
+		  if (i % 11 == 0) {
+		    text += "00";
+		  }
+		  text += std::to_string(sample);
+		  text += (i % 3 == 2) ? ((i % 2) ? "\r\n" : "\n") : " ";
+		  expected.push_back(sample);
+		}
+
+		// parse with the serial reader, and in chunks of every size
+		// both sequentially and on a pool, expecting identical results
+		auto serial = [](const std::string& text, std::vector<uint8_t>& samples) {
+		  std::istringstream f(text);
+		  return gfx::ppm_text_reader(f, 255).read(samples.data(), samples.data() + samples.size());
+		};
+		gfx::thread_pool pool(3);
+		const std::vector<gfx::execution_policy> policies = { gfx::sequential(), gfx::parallel(pool) };
+		const std::vector<std::size_t> chunk_sizes = { 1, 100, 1000, 5000, gfx::PPM_TEXT_CHUNK_SIZE };
+		for (std::size_t run = 0; run < policies.size() * chunk_sizes.size(); ++run) {
+		  const gfx::execution_policy& policy = policies[run % policies.size()];
+		  std::size_t chunk_size = chunk_sizes[run / policies.size()];
+		  std::vector<uint8_t> samples(expected.size());
+		  TEST_TRUE("parallel text ppm parsing : samples",
+			    gfx::ppm_parse_text_samples(text.data(), text.data() + text.size(), 255,
+							samples.data(), samples.size(), policy, chunk_size));
+		  TEST_TRUE("parallel text ppm parsing : samples", expected == samples);
+
+		  // fewer samples than the text holds, ignoring anything after them
+		  std::vector<uint8_t> prefix(1000);
+		  std::string trailing = text + "garbage";
+		  TEST_TRUE("parallel text ppm parsing : prefix",
+			    gfx::ppm_parse_text_samples(trailing.data(), trailing.data() + trailing.size(), 255,
+							prefix.data(), prefix.size(), policy, chunk_size));
+		  TEST_TRUE("parallel text ppm parsing : prefix",
+			    std::equal(prefix.begin(), prefix.end(), expected.begin()));
+		}
+
+		// malformed text fails exactly when the serial reader does
+		std::vector<std::string> variants = { text + "1",
+						      text.substr(0, text.size() / 2),
+						      text.substr(0, 5000) + "x" + text.substr(5000),
+						      text.substr(0, 5000) + "-" + text.substr(5000),
+						      text.substr(0, 9000) + "999 " + text.substr(9000),
+						      "1 2 3\n" + text };
+		for (auto& variant : variants) {
+		  std::vector<uint8_t> serial_samples(expected.size());
+		  bool serial_ok = serial(variant, serial_samples);
+		  for (std::size_t run = 0; run < policies.size() * chunk_sizes.size(); ++run) {
+		    std::vector<uint8_t> samples(expected.size());
+		    bool ok = gfx::ppm_parse_text_samples(variant.data(), variant.data() + variant.size(), 255,
+							  samples.data(), samples.size(),
+							  policies[run % policies.size()],
+							  chunk_sizes[run / policies.size()]);
+		    TEST_EQUAL("parallel text ppm parsing : malformed", serial_ok, ok);
+		    if (ok) {
+		      TEST_TRUE("parallel text ppm parsing : malformed", serial_samples == samples);
+		    }
+		  }
+		}
+
+		// ppm_read takes the parallel path when told to, whatever the
+		// file size and hardware
+		gfx::true_color_image streamed, parsed;
+		TEST_TRUE("parallel text ppm parsing : ppm_read",
+			  gfx::ppm_read(streamed, ascii_ppm_path, gfx::sequential()));
+		for (int threads = 2; threads <= 8; threads += 3) {
+		  gfx::thread_pool read_pool(threads);
+		  TEST_TRUE("parallel text ppm parsing : ppm_read",
+			    gfx::ppm_read(parsed, ascii_ppm_path, gfx::parallel(read_pool), 1));
+		  TEST_EQUAL("parallel text ppm parsing : ppm_read", streamed, parsed);
+		}
+		std::string file;
+		{
+		  std::ifstream f(ascii_ppm_path, std::ios_base::binary);
+		  std::ostringstream contents;
+		  contents << f.rdbuf();
+		  file = contents.str();
+		}
+		const std::string temp_path("temp.ppm");
+		{
+		  std::ofstream f(temp_path, std::ios_base::binary);
+		  f << file.substr(0, file.size() - 100);
+		}
+		TEST_FALSE("parallel text ppm parsing : truncated", gfx::ppm_read(parsed, temp_path, gfx::parallel(pool), 1));
+		TEST_TRUE("parallel text ppm parsing : truncated", parsed.empty());
+		{
+		  std::ofstream f(temp_path, std::ios_base::binary);
+		  f << file.substr(0, file.size() / 2) << " 256 " << file.substr(file.size() / 2);
+		}
+		TEST_FALSE("parallel text ppm parsing : out of range", gfx::ppm_read(parsed, temp_path, gfx::parallel(pool), 1));
+		std::remove(temp_path.c_str());
+	      });
+
+  r.criterion("thread_pool, execution_policy",
+	      1,
+	      [&]() {
+		gfx::thread_pool pool(3);
+		TEST_EQUAL("thread_pool : thread_count", 3, pool.thread_count());
+		TEST_TRUE("execution_policy : parallel", gfx::parallel(pool).is_parallel());
+		TEST_FALSE("execution_policy : sequential", gfx::sequential().is_parallel());
+		gfx::thread_pool single(1);
+		TEST_FALSE("execution_policy : one thread", gfx::parallel(single).is_parallel());
+
+		// every task runs exactly once, batch after batch
+		for (int batch = 0; batch < 50; ++batch) {
+		  std::vector<int> runs(100, 0);
+		  pool.run(100, [&](int i) { ++runs[i]; });
+		  TEST_EQUAL("thread_pool : run", 100, std::count(runs.begin(), runs.end(), 1));
+		}
+
+		// a task may run a batch of its own
+		std::vector<int> nested(20, 0);
+		pool.run(4, [&](int i) { pool.run(5, [&](int j) { ++nested[5 * i + j]; }); });
+		TEST_EQUAL("thread_pool : nested", 20, std::count(nested.begin(), nested.end(), 1));
+
+		// exceptions reach the caller, and the pool still works
+		bool thrown = false;
+		try {
+		  pool.run(10, [](int i) { if (i == 7) { throw std::runtime_error("task"); } });
+		} catch (const std::runtime_error&) {
+		  thrown = true;
+		}
+		TEST_TRUE("thread_pool : exception", thrown);
+		std::vector<int> runs(10, 0);
+		pool.run(10, [&](int i) { ++runs[i]; });
+		TEST_EQUAL("thread_pool : after exception", 10, std::count(runs.begin(), runs.end(), 1));
+
+		// every filter gives bit-identical results in parallel; the
+		// height is not a multiple of the band height, so the last band
+		// is short
+		gfx::true_color_image before = pattern_image(53, 150);
+		gfx::hdr_image hdr_before;
+		before.convert_to(hdr_before);
+
+		auto check = [&](const std::string& message,
+				 const std::function<void(const gfx::execution_policy&,
+							  gfx::true_color_image&,
+							  gfx::hdr_image&)>& filter) {
+		  gfx::true_color_image sequential, parallel;
+		  gfx::hdr_image hdr_sequential, hdr_parallel;
+		  filter(gfx::sequential(), sequential, hdr_sequential);
+		  filter(gfx::parallel(pool), parallel, hdr_parallel);
+		  TEST_FALSE(message, sequential.empty());
+		  TEST_EQUAL(message, sequential, parallel);
+		  TEST_EQUAL(message, hdr_sequential, hdr_parallel);
+		};
+		check("execution_policy : clear_component", [&](const gfx::execution_policy& p, gfx::true_color_image& a, gfx::hdr_image& h) {
+		    gfx::clear_component(p, a, before, gfx::RGB_INDEX_GREEN);
+		    gfx::clear_component(p, h, hdr_before, gfx::RGB_INDEX_GREEN);
+		  });
+		check("execution_policy : scale_component", [&](const gfx::execution_policy& p, gfx::true_color_image& a, gfx::hdr_image& h) {
+		    gfx::scale_component(p, a, before, gfx::RGB_INDEX_RED, 1.7);
+		    gfx::scale_component(p, h, hdr_before, gfx::RGB_INDEX_RED, 1.7);
+		  });
+		check("execution_policy : crop", [&](const gfx::execution_policy& p, gfx::true_color_image& a, gfx::hdr_image& h) {
+		    gfx::crop(p, a, before, 5, 7, 40, 130);
+		    gfx::crop(p, h, hdr_before, 5, 7, 40, 130);
+		  });
+		check("execution_policy : extend_edges", [&](const gfx::execution_policy& p, gfx::true_color_image& a, gfx::hdr_image& h) {
+		    gfx::extend_edges(p, a, before, 9);
+		    gfx::extend_edges(p, h, hdr_before, 9);
+		  });
+		check("execution_policy : grayscale", [&](const gfx::execution_policy& p, gfx::true_color_image& a, gfx::hdr_image& h) {
+		    gfx::grayscale(p, a, before.view(1, 2, 50, 140));
+		    gfx::grayscale(p, h, hdr_before.view(1, 2, 50, 140));
+		  });
+		for (gfx::border_policy border : {gfx::BORDER_CLAMP, gfx::BORDER_MIRROR, gfx::BORDER_WRAP, gfx::BORDER_CONSTANT}) {
+		  check("execution_policy : edge_detect", [&](const gfx::execution_policy& p, gfx::true_color_image& a, gfx::hdr_image& h) {
+		      gfx::edge_detect(p, a, before, border);
+		      gfx::edge_detect(p, h, hdr_before, border);
+		    });
+		  for (int radius : {1, 4, 20, 200}) {
+		    check("execution_policy : box_blur", [&](const gfx::execution_policy& p, gfx::true_color_image& a, gfx::hdr_image& h) {
+			gfx::box_blur(p, a, before, radius, border);
+			gfx::box_blur(p, h, hdr_before, radius, border);
+		      });
+		  }
+		  check("execution_policy : convolve", [&](const gfx::execution_policy& p, gfx::true_color_image& a, gfx::hdr_image& h) {
+		      gfx::convolve(p, a, before, gfx::emboss_kernel(), border);
+		      gfx::convolve(p, h, hdr_before, gfx::emboss_kernel(), border);
+		    });
+		  gfx::vector<float, 5> row5({1, 4, 6, 4, 1});
+		  gfx::vector<float, 3> column3({.25f, .5f, .25f});
+		  check("execution_policy : convolve_separable", [&](const gfx::execution_policy& p, gfx::true_color_image& a, gfx::hdr_image& h) {
+		      gfx::convolve_separable(p, a, before, row5 * (1 / 16.0f), column3, border);
+		      gfx::convolve_separable(p, h, hdr_before, row5 * (1 / 16.0f), column3, border);
+		    });
+		}
+
+		// box_blur splits a wide image into column strips, the last one
+		// narrower, however large the radius
+		gfx::true_color_image wide = pattern_image(150, 20);
+		gfx::hdr_image hdr_wide;
+		wide.convert_to(hdr_wide);
+		for (int radius : {3, 10, 100}) {
+		  check("execution_policy : box_blur strips", [&](const gfx::execution_policy& p, gfx::true_color_image& a, gfx::hdr_image& h) {
+		      gfx::box_blur(p, a, wide, radius, gfx::BORDER_WRAP);
+		      gfx::box_blur(p, h, hdr_wide, radius, gfx::BORDER_WRAP);
+		    });
+		}
+
+		// the tiled filters give the same results with any tile size,
+		// here one that splits every row and leaves short tiles on the
+		// right and bottom edges
+		TEST_EQUAL("execution_policy : tile size", gfx::DEFAULT_TILE_WIDTH, gfx::sequential().tile_width());
+		TEST_EQUAL("execution_policy : tile size", gfx::DEFAULT_TILE_HEIGHT, gfx::parallel(pool).tile_height());
+		gfx::scheduler tasks(3);
+		const gfx::execution_policy small_tiles = gfx::parallel(tasks).with_tile_size(7, 5);
+		TEST_TRUE("execution_policy : tile size", small_tiles.is_parallel());
+		TEST_EQUAL("execution_policy : tile size", 7, small_tiles.tile_width());
+		TEST_EQUAL("execution_policy : tile size", 5, small_tiles.tile_height());
+		auto check_tiles = [&](const std::string& message,
+				       const std::function<void(const gfx::execution_policy&,
+								gfx::true_color_image&,
+								gfx::hdr_image&)>& filter) {
+		  gfx::true_color_image sequential, tiled;
+		  gfx::hdr_image hdr_sequential, hdr_tiled;
+		  filter(gfx::sequential(), sequential, hdr_sequential);
+		  filter(small_tiles, tiled, hdr_tiled);
+		  TEST_FALSE(message, sequential.empty());
+		  TEST_EQUAL(message, sequential, tiled);
+		  TEST_EQUAL(message, hdr_sequential, hdr_tiled);
+		};
+		check_tiles("execution_policy : tiled clear_component", [&](const gfx::execution_policy& p, gfx::true_color_image& a, gfx::hdr_image& h) {
+		    gfx::clear_component(p, a, before, gfx::RGB_INDEX_BLUE);
+		    gfx::clear_component(p, h, hdr_before, gfx::RGB_INDEX_BLUE);
+		  });
+		check_tiles("execution_policy : tiled scale_component", [&](const gfx::execution_policy& p, gfx::true_color_image& a, gfx::hdr_image& h) {
+		    gfx::scale_component(p, a, before, gfx::RGB_INDEX_GREEN, 1.3);
+		    gfx::scale_component(p, h, hdr_before, gfx::RGB_INDEX_GREEN, 1.3);
+		  });
+		const auto invert = gfx::make_lookup_table<gfx::true_color_depth>([](uint8_t v) { return uint8_t(255 - v); });
+		check_tiles("execution_policy : tiled apply_lut", [&](const gfx::execution_policy& p, gfx::true_color_image& a, gfx::hdr_image& h) {
+		    gfx::apply_lut(p, a, before, gfx::RGB_INDEX_RED, invert);
+		    h = hdr_before;
+		  });
+		check_tiles("execution_policy : tiled grayscale", [&](const gfx::execution_policy& p, gfx::true_color_image& a, gfx::hdr_image& h) {
+		    gfx::grayscale(p, a, before.view(3, 1, 47, 140));
+		    gfx::grayscale(p, h, hdr_before.view(3, 1, 47, 140));
+		  });
+		const auto chain = gfx::pixel_pipeline<>()
+		  .then(gfx::clear_component_op(gfx::RGB_INDEX_GREEN))
+		  .then(gfx::scale_component_op(gfx::RGB_INDEX_RED, 1.3))
+		  .then(gfx::grayscale_op());
+		check_tiles("execution_policy : tiled pixel_pipeline", [&](const gfx::execution_policy& p, gfx::true_color_image& a, gfx::hdr_image& h) {
+		    chain.apply(p, a, before);
+		    chain.apply(p, h, hdr_before);
+		  });
+		for (gfx::border_policy border : {gfx::BORDER_CLAMP, gfx::BORDER_MIRROR, gfx::BORDER_WRAP, gfx::BORDER_CONSTANT}) {
+		  check_tiles("execution_policy : tiled convolve", [&](const gfx::execution_policy& p, gfx::true_color_image& a, gfx::hdr_image& h) {
+		      gfx::convolve(p, a, before, gfx::emboss_kernel(), border);
+		      gfx::convolve(p, h, hdr_before, gfx::emboss_kernel(), border);
+		    });
+		}
+
+		// the overloads without a policy are sequential
+		TEST_EQUAL("execution_policy : default", gfx::box_blur(before, 4), [&]() {
+		    gfx::true_color_image after;
+		    gfx::box_blur(gfx::parallel(pool), after, before, 4);
+		    return after;
+		  }());
+	      });
+
+  r.criterion("scheduler",
+	      1,
+	      [&]() {
+		gfx::scheduler tasks(3);
+		TEST_EQUAL("scheduler : thread_count", 3, tasks.thread_count());
+		TEST_TRUE("scheduler : parallel", gfx::parallel(tasks).is_parallel());
+
+		// every task runs exactly once, batch after batch
+		for (int batch = 0; batch < 50; ++batch) {
+		  std::vector<int> runs(batch, 0);
+		  tasks.run(batch, [&](int i) { ++runs[i]; });
+		  TEST_EQUAL("scheduler : run", batch, std::count(runs.begin(), runs.end(), 1));
+		}
+
+		// the first block of tasks is slow, so other threads steal it;
+		// every task and all busy time is accounted for
+		tasks.reset_stats();
+		std::vector<int> runs(30, 0);
+		tasks.run(30, [&](int i) {
+		    if (i < 10) {
+		      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		    }
+		    ++runs[i];
+		  });
+		TEST_EQUAL("scheduler : stealing", 30, std::count(runs.begin(), runs.end(), 1));
+		std::vector<gfx::scheduler::worker_stats> stats = tasks.stats();
+		TEST_EQUAL("scheduler : stats", 3, stats.size());
+		std::size_t task_total = 0, steal_total = 0;
+		double busy_total = 0;
+		for (auto& worker : stats) {
+		  task_total += worker.tasks;
+		  steal_total += worker.steals;
+		  busy_total += worker.busy_seconds;
+		  TEST_GE("scheduler : stats", worker.idle_seconds, 0.0);
+		}
+		TEST_EQUAL("scheduler : stats", 30, task_total);
+		TEST_GT("scheduler : stats", steal_total, 0);
+		TEST_GE("scheduler : stats", busy_total, 0.045);
+		tasks.reset_stats();
+		TEST_EQUAL("scheduler : reset_stats", 0, tasks.stats()[1].tasks);
+
+		// exceptions reach the caller
+		bool thrown = false;
+		try {
+		  tasks.run(10, [](int i) { if (i == 3) { throw std::runtime_error("task"); } });
+		} catch (const std::runtime_error&) {
+		  thrown = true;
+		}
+		TEST_TRUE("scheduler : exception", thrown);
+
+		// tiles cover the rectangle exactly once, clipped at the edges
+		for (const gfx::execution_policy& policy : {gfx::sequential(), gfx::parallel(tasks)}) {
+		  std::vector<int> covered(50 * 37, 0);
+		  int tile_count = 0;
+		  std::mutex count_mutex;
+		  gfx::for_each_tile(policy, 50, 37, 16, 8, [&](const gfx::tile& t) {
+		      TEST_TRUE("for_each_tile : size", (t.width == 16) || ((t.left == 48) && (t.width == 2)));
+		      TEST_TRUE("for_each_tile : size", (t.height == 8) || ((t.top == 32) && (t.height == 5)));
+		      for (int y = t.top; y < t.top + t.height; ++y) {
+			for (int x = t.left; x < t.left + t.width; ++x) {
+			  ++covered[y * 50 + x];
+			}
+		      }
+		      std::lock_guard<std::mutex> lock(count_mutex);
+		      ++tile_count;
+		    });
+		  TEST_EQUAL("for_each_tile : tiles", 4 * 5, tile_count);
+		  TEST_EQUAL("for_each_tile : coverage", 50 * 37, std::count(covered.begin(), covered.end(), 1));
+		}
+
+		// filters submitted to the scheduler match the sequential ones
+		gfx::true_color_image before, sequential, scheduled;
+		TEST_TRUE("scheduler : load before image", gfx::ppm_read(before, binary_ppm_path));
+		gfx::edge_detect(sequential, before);
+		gfx::edge_detect(gfx::parallel(tasks), scheduled, before);
+		TEST_EQUAL("scheduler : edge_detect", sequential, scheduled);
+		gfx::box_blur(sequential, before, 7, gfx::BORDER_MIRROR);
+		gfx::box_blur(gfx::parallel(tasks), scheduled, before, 7, gfx::BORDER_MIRROR);
+		TEST_EQUAL("scheduler : box_blur", sequential, scheduled);
+		gfx::scale_component(sequential, before, gfx::RGB_INDEX_BLUE, .6);
+		gfx::scale_component(gfx::parallel(tasks), scheduled, before, gfx::RGB_INDEX_BLUE, .6);
+		TEST_EQUAL("scheduler : scale_component", sequential, scheduled);
+		std::size_t filter_tasks = 0;
+		for (auto& worker : tasks.stats()) {
+		  filter_tasks += worker.tasks;
+		}
+		TEST_GT("scheduler : filter tasks", filter_tasks, 3);
+	      });
+
+  r.criterion("pixel_pipeline",
+	      1,
+	      [&]() {
+		gfx::true_color_image before;
+		TEST_TRUE("pixel_pipeline : load before image", gfx::ppm_read(before, binary_ppm_path));
+		gfx::hdr_image hdr_before;
+		before.convert_to(hdr_before);
+
+		// alternating native and HDR operations match the filters run
+		// one after another
+		auto chain = gfx::pixel_pipeline<>()
+		  .then(gfx::clear_component_op(gfx::RGB_INDEX_GREEN))
+		  .then(gfx::scale_component_op(gfx::RGB_INDEX_RED, 1.3))
+		  .then(gfx::grayscale_op());
+		gfx::true_color_image expected = gfx::grayscale(gfx::scale_component(gfx::clear_component(before, gfx::RGB_INDEX_GREEN),
+										     gfx::RGB_INDEX_RED, 1.3));
+		TEST_EQUAL("pixel_pipeline : true color", expected, chain.apply(before));
+		gfx::hdr_image hdr_expected = gfx::grayscale(gfx::scale_component(gfx::clear_component(hdr_before, gfx::RGB_INDEX_GREEN),
+										  gfx::RGB_INDEX_RED, 1.3));
+		TEST_EQUAL("pixel_pipeline : hdr", hdr_expected, chain.apply(hdr_before));
+
+		// a run of HDR operations skips the rounding in between, so HDR
+		// results match the filters; true color scales go through
+		// tables, so they match the filters exactly
+		auto scales = gfx::pixel_pipeline<>()
+		  .then(gfx::scale_component_op(gfx::RGB_INDEX_RED, 1.1))
+		  .then(gfx::scale_component_op(gfx::RGB_INDEX_BLUE, .9))
+		  .then(gfx::scale_component_op(gfx::RGB_INDEX_RED, .8));
+		expected = gfx::scale_component(gfx::scale_component(gfx::scale_component(before, gfx::RGB_INDEX_RED, 1.1),
+								     gfx::RGB_INDEX_BLUE, .9),
+						gfx::RGB_INDEX_RED, .8);
+		TEST_EQUAL("pixel_pipeline : 8-bit scales", expected, scales.apply(before));
+		hdr_expected = gfx::scale_component(gfx::scale_component(gfx::scale_component(hdr_before, gfx::RGB_INDEX_RED, 1.1),
+									 gfx::RGB_INDEX_BLUE, .9),
+						    gfx::RGB_INDEX_RED, .8);
+		TEST_EQUAL("pixel_pipeline : HDR run", hdr_expected, scales.apply(hdr_before));
+
+		// custom operations, one pixel at a time
+		auto custom = gfx::pixel_pipeline<>()
+		  .then(gfx::pixel_op([](gfx::true_color_rgb& pixel) { pixel.red() = 255 - pixel.red(); }))
+		  .then(gfx::hdr_pixel_op([](gfx::hdr_rgb& pixel) { pixel.blue() = pixel.green(); }));
+		gfx::true_color_rgb pixel(10, 100, 200);
+		gfx::pixel_pipeline<>()(pixel);
+		TEST_EQUAL("pixel_pipeline : empty", gfx::true_color_rgb(10, 100, 200), pixel);
+		custom(pixel);
+		TEST_EQUAL("pixel_pipeline : custom", gfx::true_color_rgb(245, 100, 100), pixel);
+
+		// views, and parallel application
+		gfx::thread_pool pool(3);
+		gfx::true_color_image sequential, parallel;
+		chain.apply(sequential, before.view(5, 7, 30, 40));
+		chain.apply(gfx::parallel(pool), parallel, before.view(5, 7, 30, 40));
+		expected = gfx::grayscale(gfx::scale_component(gfx::clear_component(before, gfx::RGB_INDEX_GREEN),
+							       gfx::RGB_INDEX_RED, 1.3));
+		TEST_EQUAL("pixel_pipeline : view", gfx::crop(expected, 5, 7, 30, 40), sequential);
+		TEST_EQUAL("pixel_pipeline : parallel", sequential, parallel);
+	      });
+
+  r.criterion("apply_lut, 8-bit scale_component",
+	      1,
+	      [&]() {
+		// every intensity in every component
+		gfx::true_color_image before(256, 3);
+		for (int x = 0; x < 256; ++x) {
+		  before.pixel(x, 0).assign(x, 255 - x, (x * 7) % 256);
+		  before.pixel(x, 1).assign(255 - x, (x * 7) % 256, x);
+		  before.pixel(x, 2).assign((x * 7) % 256, x, 255 - x);
+		}
+
+		// the table gives the same result as scaling in HDR
+		gfx::hdr_image hdr_before, hdr_scaled;
+		before.convert_to(hdr_before);
+		for (double factor : {0.0, 0.3, 0.5, 1.0, 1.3, 2.7, 300.0}) {
+		  for (gfx::rgb_index component : {gfx::RGB_INDEX_RED, gfx::RGB_INDEX_GREEN, gfx::RGB_INDEX_BLUE}) {
+		    gfx::true_color_image expected;
+		    gfx::scale_component(hdr_before, component, factor).convert_to(expected);
+		    TEST_EQUAL("8-bit scale_component", expected, gfx::scale_component(before, component, factor));
+		  }
+		}
+
+		// an inverting table, on a view and in parallel
+		gfx::lookup_table<gfx::true_color_depth> invert =
+		  gfx::make_lookup_table<gfx::true_color_depth>([](uint8_t v) { return uint8_t(255 - v); });
+		TEST_EQUAL("make_lookup_table", 256, invert.size());
+		TEST_EQUAL("make_lookup_table", 255, invert[0]);
+		TEST_EQUAL("make_lookup_table", 55, invert[200]);
+		gfx::true_color_image inverted = gfx::apply_lut(before.view(10, 1, 100, 2), gfx::RGB_INDEX_GREEN, invert);
+		TEST_EQUAL("apply_lut : width", 100, inverted.width());
+		TEST_EQUAL("apply_lut : height", 2, inverted.height());
+		for (int y = 0; y < 2; ++y) {
+		  for (int x = 0; x < 100; ++x) {
+		    const gfx::true_color_rgb& original = before.pixel(x + 10, y + 1);
+		    TEST_EQUAL("apply_lut : pixel",
+			       gfx::true_color_rgb(original.red(), 255 - original.green(), original.blue()),
+			       inverted.pixel(x, y));
+		  }
+		}
+		gfx::thread_pool pool(3);
+		gfx::true_color_image large(70, 200), sequential, parallel;
+		for (int y = 0; y < large.height(); ++y) {
+		  for (int x = 0; x < large.width(); ++x) {
+		    large.pixel(x, y).assign((x * y) % 256, x, y);
+		  }
+		}
+		gfx::apply_lut(sequential, large, gfx::RGB_INDEX_BLUE, invert);
+		gfx::apply_lut(gfx::parallel(pool), parallel, large, gfx::RGB_INDEX_BLUE, invert);
+		TEST_EQUAL("apply_lut : parallel", sequential, parallel);
+		auto inverting = gfx::pixel_pipeline<>().then(gfx::lut_op<gfx::true_color_depth>(gfx::RGB_INDEX_BLUE, invert));
+		TEST_EQUAL("lut_op", sequential, inverting.apply(large));
+	      });
+
+  r.criterion("grayscale kernels, luminance weights",
+	      1,
+	      [&]() {
+		// known intensities
+		TEST_EQUAL("luminance : default", 92, gfx::luminance(gfx::true_color_rgb(10, 100, 200)));
+		TEST_EQUAL("luminance : Rec. 601 red", 76, gfx::luminance(gfx::true_color_rgb(255, 0, 0), gfx::LUMINANCE_REC_601));
+		TEST_EQUAL("luminance : Rec. 709 green", 182, gfx::luminance(gfx::true_color_rgb(0, 255, 0), gfx::LUMINANCE_REC_709));
+		for (gfx::luminance_weights weights : {gfx::LUMINANCE_DEFAULT, gfx::LUMINANCE_REC_601, gfx::LUMINANCE_REC_709}) {
+		  bool grays_unchanged = true;
+		  for (int v = 0; v < 256; ++v) {
+		    grays_unchanged = grays_unchanged && (gfx::luminance(gfx::true_color_rgb(v, v, v), weights) == v);
+		  }
+		  TEST_TRUE("luminance : grays unchanged", grays_unchanged);
+		  TEST_EQUAL("luminance : HDR white", 1.0f, gfx::luminance(gfx::hdr_rgb(1, 1, 1), weights));
+		}
+
+		// every kernel matches the scalar one, for every row length
+		// around the vector widths
+		srand(25);
+		std::vector<uint8_t> bytes(3 * 70);
+		std::vector<float> floats(3 * 70);
+		for (std::size_t i = 0; i < bytes.size(); ++i) {
+		  bytes[i] = rand() % 256;
+		  floats[i] = (rand() % 1001) / 1000.0f;
+		}
+		const uint16_t* fixed_weights = gfx::fixed_point_luminance_weights(gfx::LUMINANCE_REC_601);
+		const float* float_weights = gfx::float_luminance_weights(gfx::LUMINANCE_REC_601);
+		for (gfx::simd_level level : {gfx::SIMD_SSE2, gfx::SIMD_AVX2}) {
+		  bool bytes_match = true, floats_match = true;
+		  for (int count = 0; count <= 70; ++count) {
+		    std::vector<uint8_t> scalar_bytes(bytes.size(), 7), vector_bytes(bytes.size(), 7);
+		    gfx::gray_row(&bytes[0], &scalar_bytes[0], count, fixed_weights, gfx::SIMD_SCALAR);
+		    gfx::gray_row(&bytes[0], &vector_bytes[0], count, fixed_weights, level);
+		    bytes_match = bytes_match && (scalar_bytes == vector_bytes);
+		    std::vector<float> scalar_floats(floats.size(), 7), vector_floats(floats.size(), 7);
+		    gfx::gray_row(&floats[0], &scalar_floats[0], count, float_weights, gfx::SIMD_SCALAR);
+		    gfx::gray_row(&floats[0], &vector_floats[0], count, float_weights, level);
+		    floats_match = floats_match && (scalar_floats == vector_floats);
+		  }
+		  TEST_TRUE("gray_row : 8-bit kernel", bytes_match);
+		  TEST_TRUE("gray_row : float kernel", floats_match);
+		}
+
+		// other floating-point depths take the per-pixel path
+		using double_depth = gfx::color_depth<double, 1>;
+		gfx::image<double_depth> doubles(5, 3, gfx::rgb<double_depth>(.5, .25, 1));
+		gfx::image<double_depth> double_gray = gfx::grayscale(doubles, gfx::LUMINANCE_REC_709);
+		const double double_expected = gfx::luminance(doubles.pixel(4, 2), gfx::LUMINANCE_REC_709);
+		TEST_TRUE("grayscale : double", std::abs(double_expected - (.5 * .2126 + .25 * .7152 + .0722)) < 1e-6);
+		TEST_EQUAL("grayscale : double",
+			   gfx::image<double_depth>(5, 3, gfx::rgb<double_depth>(double_expected, double_expected, double_expected)),
+			   double_gray);
+
+		// grayscale, grayscale_op and luminance agree for each weight set
+		gfx::true_color_image before;
+		TEST_TRUE("grayscale weights : load before image", gfx::ppm_read(before, binary_ppm_path));
+		gfx::hdr_image hdr_before;
+		before.convert_to(hdr_before);
+		for (gfx::luminance_weights weights : {gfx::LUMINANCE_DEFAULT, gfx::LUMINANCE_REC_601, gfx::LUMINANCE_REC_709}) {
+		  gfx::true_color_image gray = gfx::grayscale(before, weights);
+		  gfx::hdr_image hdr_gray = gfx::grayscale(hdr_before, weights);
+		  gfx::true_color_rgb pixel = before.pixel(37, 21);
+		  uint8_t expected = gfx::luminance(pixel, weights);
+		  TEST_EQUAL("grayscale weights : pixel", gfx::true_color_rgb(expected, expected, expected), gray.pixel(37, 21));
+		  auto pipeline = gfx::pixel_pipeline<>().then(gfx::grayscale_op(weights));
+		  TEST_EQUAL("grayscale weights : grayscale_op", gray, pipeline.apply(before));
+		  TEST_EQUAL("grayscale weights : HDR grayscale_op", hdr_gray, pipeline.apply(hdr_before));
+		  float hdr_expected = gfx::luminance(hdr_before.pixel(37, 21), weights);
+		  TEST_EQUAL("grayscale weights : HDR pixel", gfx::hdr_rgb(hdr_expected, hdr_expected, hdr_expected), hdr_gray.pixel(37, 21));
+		}
+	      });
+
+  r.criterion("edge_detect against a direct Sobel",
+	      1,
+	      [&]() {
+		// A direct Sobel over luminance, one pixel at a time, with its
+		// own border handling.
+		auto reference = [](const gfx::true_color_image& before,
+				    gfx::border_policy border,
+				    const gfx::true_color_rgb& border_color) {
+		  const int w = before.width(), h = before.height();
+		  auto resolve = [&](int i, int n) {
+		    if ((i >= 0) && (i < n)) {
+		      return i;
+		    }
+		    switch (border) {
+		    case gfx::BORDER_CLAMP: return std::min(std::max(i, 0), n - 1);
+		    case gfx::BORDER_MIRROR: return (i < 0) ? (-i - 1) : (2 * n - 1 - i);
+		    case gfx::BORDER_WRAP: return (i + n) % n;
+		    default: return -1;
+		    }
+		  };
+		  auto gray = [&](int x, int y) {
+		    int in_x = resolve(x, w), in_y = resolve(y, h);
+		    return int(gfx::luminance((in_x < 0 || in_y < 0) ? border_color : before.pixel(in_x, in_y)));
+		  };
+		  const int sobel[3][3] = {{-1, 0, 1}, {-2, 0, 2}, {-1, 0, 1}};
+		  gfx::true_color_image after(w, h);
+		  for (int y = 0; y < h; ++y) {
+		    for (int x = 0; x < w; ++x) {
+		      int gx = 0, gy = 0;
+		      for (int i = 0; i < 3; ++i) {
+			for (int j = 0; j < 3; ++j) {
+			  gx += gray(x + j - 1, y + i - 1) * sobel[i][j];
+			  gy += gray(x + j - 1, y + i - 1) * sobel[j][i];
+			}
+		      }
+		      double magnitude = std::min(std::sqrt(double(gx) * gx + double(gy) * gy), 255.0);
+		      uint8_t value = uint8_t(magnitude);
+		      after.pixel(x, y).assign(value, value, value);
+		    }
+		  }
+		  return after;
+		};
+
+		auto detect = [](const gfx::true_color_image& before,
+				 gfx::border_policy border,
+				 const gfx::true_color_rgb& border_color) {
+		  gfx::true_color_image after;
+		  gfx::edge_detect(after, before, border, border_color);
+		  return after;
+		};
+
+		// every border policy matches it exactly
+		gfx::true_color_image before;
+		TEST_TRUE("edge_detect : load before image", gfx::ppm_read(before, binary_ppm_path));
+		gfx::true_color_image region(before.view(30, 40, 41, 23));
+		const gfx::true_color_rgb border_color(250, 20, 10);
+		for (int policy = 0; policy < 4; ++policy) {
+		  TEST_EQUAL("edge_detect : matches direct Sobel",
+			     reference(region, gfx::border_policy(policy), border_color),
+			     detect(region, gfx::border_policy(policy), border_color));
+		}
+
+		// a uniform image has edges only against a constant border, of
+		// the border color's luminance rather than any one component
+		gfx::true_color_image uniform(12, 9, gfx::true_color_rgb(200, 40, 90));
+		TEST_EQUAL("edge_detect : uniform luminance", 77, gfx::luminance(uniform.pixel(0, 0)));
+		TEST_EQUAL("edge_detect : border luminance", 65, gfx::luminance(border_color));
+		gfx::true_color_image edges = detect(uniform, gfx::BORDER_CONSTANT, border_color);
+		TEST_EQUAL("edge_detect : constant border", reference(uniform, gfx::BORDER_CONSTANT, border_color), edges);
+		TEST_EQUAL("edge_detect : interior", gfx::true_color_rgb(0, 0, 0), edges.pixel(5, 4));
+		TEST_EQUAL("edge_detect : side", gfx::true_color_rgb(48, 48, 48), edges.pixel(0, 4)); // 4 * (77 - 65)
+		TEST_EQUAL("edge_detect : side", gfx::true_color_rgb(48, 48, 48), edges.pixel(5, 8));
+		TEST_EQUAL("edge_detect : corner", gfx::true_color_rgb(50, 50, 50), edges.pixel(11, 0)); // 3 * 12 * sqrt(2)
+		TEST_EQUAL("edge_detect : no edges when clamped", gfx::true_color_image(12, 9, gfx::BLACK), gfx::edge_detect(uniform, gfx::BORDER_CLAMP));
+	      });
+
   return r.run();
 }
@@ -0,0 +1,161 @@
+///////////////////////////////////////////////////////////////////////////////
+// gfxintegral.hh
+//
+// Summed-area tables, also known as integral images. An
+// integral_image<color_depth_type> is built from an image in one
+// linear pass, after which the sum of the pixels in any rectangle
+// can be found in O(1) time. This makes box filters, adaptive
+// thresholding, and region statistics cheap even when many
+// rectangles are queried per frame.
+//
+// This module builds on gfximage.hh, so familiarize yourself with
+// that file before using this one.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <vector>
+
+#include "gfximage.hh"
+
+namespace gfx {
+
+  // A summed-area table of an image. Conceptually, for every 0 <= x
+  // <= width and 0 <= y <= height, the table holds the per-channel
+  // sum of all source pixels strictly above and to the left of
+  // (x, y). Sums use color_depth::accumulator_type, which is a 64-bit
+  // integer for true color and double for HDR, so even an 8K frame of
+  // white pixels cannot overflow.
+  //
+  // Like image, an integral_image may be empty, with zero width and
+  // height.
+  template <typename color_depth_parameter>
+  class integral_image {
+  public:
+
+    // Type aliases.
+    using color_depth = color_depth_parameter;
+    using same_type = integral_image<color_depth>;
+    using accumulator_type = typename color_depth::accumulator_type;
+    using sum_type = gfx::vector3<accumulator_type>;
+
+    // Default constructor. Creates an empty table.
+    integral_image()
+      : _width(0),
+	_height(0) { }
+
+    // Construct the table for source.
+    explicit integral_image(const image_view<color_depth>& source)
+      : _width(0),
+	_height(0) {
+      build(source);
+    }
+
+    // Rebuild this table from source, in one pass over its pixels. If
+    // source is empty, this table becomes empty.
+    void build(const image_view<color_depth>& source) {
+      _width = source.width();
+      _height = source.height();
+      if (source.empty()) {
+	_table.clear();
+	return;
+      }
+
+      std::size_t stride = table_stride();
+      _table.assign(stride * (_height + 1), 0);
+
+      for (int y = 0; y < _height; ++y) {
+	const rgb<color_depth>* pixels = source.row(y);
+	const accumulator_type* above = &_table[std::size_t(y) * stride];
+	accumulator_type* current = &_table[std::size_t(y + 1) * stride];
+	accumulator_type row_sum[3] = {0, 0, 0};
+	for (int x = 0; x < _width; ++x) {
+	  for (int i = 0; i < 3; ++i) {
+	    row_sum[i] += pixels[x][i];
+	    current[3 * (x + 1) + i] = above[3 * (x + 1) + i] + row_sum[i];
+	  }
+	}
+      }
+    }
+
+    // Return true iff this table is empty.
+    bool empty() const {
+      return _table.empty();
+    }
+
+    // Return the height of the source image, or 0 when empty.
+    int height() const {
+      return _height;
+    }
+
+    // Return the per-channel sum of the source pixels in the
+    // rectangle with the given top-left corner, width, and
+    // height. The rectangle must be non-empty and fit inside the
+    // source image. This takes O(1) time.
+    sum_type rect_sum(int left,
+		      int top,
+		      int width,
+		      int height) const {
+      assert(!empty());
+      assert((left >= 0) && (top >= 0));
+      assert((width > 0) && (height > 0));
+      assert(left + width <= _width);
+      assert(top + height <= _height);
+
+      int right = left + width,
+	bottom = top + height;
+      sum_type result;
+      for (int i = 0; i < 3; ++i) {
+	result[i] = (at(right, bottom, i) - at(left, bottom, i)
+		     - at(right, top, i) + at(left, top, i));
+      }
+      return result;
+    }
+
+    // Return the average color of the source pixels in the rectangle
+    // with the given top-left corner, width, and height, under the
+    // same preconditions as rect_sum. Like box_blur, an integral
+    // color depth truncates the average.
+    rgb<color_depth> rect_mean(int left,
+			       int top,
+			       int width,
+			       int height) const {
+      sum_type sum = rect_sum(left, top, width, height);
+      accumulator_type area = accumulator_type(width) * height;
+      using component_type = typename color_depth::component_type;
+      return rgb<color_depth>(static_cast<component_type>(sum[0] / area),
+			      static_cast<component_type>(sum[1] / area),
+			      static_cast<component_type>(sum[2] / area));
+    }
+
+    // Return the width of the source image, or 0 when empty.
+    int width() const {
+      return _width;
+    }
+
+  private:
+
+    // Number of accumulators in one row of the table.
+    std::size_t table_stride() const {
+      return 3 * (std::size_t(_width) + 1);
+    }
+
+    // Sum of channel i over the source pixels above and to the left
+    // of (x, y).
+    accumulator_type at(int x, int y, int i) const {
+      return _table[std::size_t(y) * table_stride() + 3 * x + i];
+    }
+
+    std::vector<accumulator_type> _table;
+    int _width, _height;
+  };
+
+  // Aliases for widely-used color depths.
+
+  using true_color_integral_image = integral_image<true_color_depth>;
+
+  using hdr_integral_image = integral_image<hdr_color_depth>;
+}
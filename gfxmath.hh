@@ -72,6 +72,7 @@
 #include <initializer_list>
 #include <memory>
 #include <ostream>
+#include <utility>
 
 namespace gfx {
 
@@ -148,11 +149,19 @@ namespace gfx {
         vector(const same_type& init)
             : _elements(init._elements) { }
 
+        vector(same_type&& init) noexcept
+            : _elements(std::move(init._elements)) { }
+
         same_type& operator=(const same_type& rhs) {
             _elements = rhs._elements;
             return *this;
         }
 
+        same_type& operator=(same_type&& rhs) noexcept {
+            _elements = std::move(rhs._elements);
+            return *this;
+        }
+
         bool operator==(const same_type& rhs) const {
             int i = 0;
             for (auto it = _elements.begin(); it != _elements.end(); ++it) {
@@ -430,6 +439,9 @@ namespace gfx {
             matrix(const same_type& rhs)
                 : _rows(rhs._rows) { }
 
+            matrix(same_type&& rhs) noexcept
+                : _rows(std::move(rhs._rows)) { }
+
             // Initializer list constructor. Elements are added in row-major
             // order, i.e. the first row is filled left-to-right, then the
             // second row, and so on. You can use this with something like
@@ -463,6 +475,11 @@ namespace gfx {
                 return *this;
             }
 
+            same_type& operator=(same_type&& rhs) noexcept {
+                _rows = std::move(rhs._rows);
+                return *this;
+            }
+
             bool operator==(const same_type& rhs) const {
                 // TODO: replace this function body with working code. Make sure
                 // to delete this comment.
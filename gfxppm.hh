@@ -14,87 +14,216 @@
 
 #pragma once
 
+#include <algorithm>
+#include <condition_variable>
+#include <cctype>
+#include <cerrno>
 #include <cstdint>
+#include <cstring>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "gfxcolor.hh"
 #include "gfximage.hh"
+#include "gfxsimd.hh"
+#include "gfxthread.hh"
 
 namespace gfx {
 
-  // Write image to a PPM file at path. When binary_samples is true,
-  // use binary samples (aka "raw" or "P6" mode). This is more
-  // space-efficient so is the default behavior. When binary_samples
-  // is false, use human-readable text samples (aka "ASCII" or "P3"
-  // mode). Return true on success, or false on I/O error.
-  bool ppm_write(const true_color_image& image,
-		 const std::string& path,
-		 bool binary_samples = true) {
+  // The longest line ppm_format_text_row may write for one pixel,
+  // " 65535 65535 65535\n".
+  const int PPM_MAX_TEXT_PIXEL_CHARS = 19;
 
-    // Writing is more straightforward since we don't need to deal
-    // with comments or format checking, so we present it first.
+  // Format the decimal representation of sample, which is in [0,
+  // 65535], into out, and return a pointer one past the last
+  // character written.
+  char* ppm_format_sample(char* out, int sample) {
+    assert((sample >= 0) && (sample <= 65535));
+    int length = (sample >= 10000) ? 5
+      : (sample >= 1000) ? 4
+      : (sample >= 100) ? 3
+      : (sample >= 10) ? 2
+      : 1;
+    char* end = out + length;
+    do {
+      *--end = '0' + (sample % 10);
+      sample /= 10;
+    } while (end != out);
+    return out + length;
+  }
 
-    // Open the file for writing, or fail.
-    std::ofstream f;
-    if (binary_samples) {
-      f.open(path, std::ios_base::binary);
-    } else {
-      f.open(path);
+  // Format the 3 * width samples of a row as textual (P3) samples
+  // into out, one pixel per line, and return a pointer one past the
+  // last character written. sample_type is uint8_t or uint16_t. Each
+  // line is the decimal representation of the three components, each
+  // preceded by a space. The leading space is permissible according
+  // to the PPM standard. out must have room for
+  // PPM_MAX_TEXT_PIXEL_CHARS characters per pixel.
+  template <typename sample_type>
+  char* ppm_format_text_row(char* out,
+			    const sample_type* samples,
+			    int width) {
+    for (int x = 0; x < width; ++x) {
+      for (int i = 0; i < 3; ++i) {
+	*out++ = ' ';
+	out = ppm_format_sample(out, *samples++);
+      }
+      *out++ = '\n';
     }
-    if (!f) {
-      return false;
+    return out;
+  }
+
+  // Convert an hdr_color_depth component to a sample in [0, 65535],
+  // clamping out-of-range components and rounding to nearest.
+  uint16_t ppm_hdr_sample(float component) {
+    if (!(component > 0)) {
+      return 0;
+    } else if (component >= 1) {
+      return 65535;
+    } else {
+      return uint16_t(component * 65535.0f + 0.5f);
     }
+  }
+
+  // Write a PPM header for a width x height image with samples in
+  // [0, maxval] to f. See ppm_write(...) for binary_samples.
+  void ppm_write_header(std::ostream& f,
+			int width,
+			int height,
+			bool binary_samples,
+			int maxval = 255) {
 
     // Decide which magic string to use.
     const std::string& magic = binary_samples ? "P6" : "P3";
 
-    // Image header. We hardcode maxval to 255.
     f << magic
       << ' '
-      << image.width()
+      << width
       << ' '
-      << image.height()
+      << height
       << ' '
-      << 255
+      << maxval
       << '\n';
+  }
 
-    // Write pixels in top-to-bottom order.
-    for (int y = 0; y < image.height(); ++y) {
-      for (int x = 0; x < image.width(); ++x) {
-
-	const gfx::true_color_rgb& pixel = image.pixel(x, y);
+  // Scratch space for reading and writing PPM payloads: text is
+  // formatted into text, and two-byte samples pass through bytes and
+  // samples. Keeping one across calls, as the row and stream readers
+  // and writers do, means rows or frames of the same size cause no
+  // allocation.
+  struct ppm_scratch {
+    std::vector<char> text;
+    std::vector<uint8_t> bytes;
+    std::vector<uint16_t> samples;
+  };
 
-	// Decide how to write this rgb.
-	if (binary_samples) {
-	  // Binary, so three unsigned bytes.
-	  uint8_t bytes[3];
-	  for (int i = 0; i < 3; ++i) {
-	    bytes[i] = pixel[i];
-	  }
-	  // Note that we are forced into a rather barbaric typecast
-	  // here, in order to ensure that f.write(...) does not
-	  // despoil the most significant bit of our bytes.
-	  f.write((char*) bytes, 3);
-	} else {
-          // Text, so write decimal representations of the three
-          // components, separated by spaces. Note that this adds a
-          // space before the first pixel, which is permissible
-          // according to the PPM standard. Further note that we need
-          // to cast the uint8_t intensity values to int so that they
-          // are printed as decimal numbers and not ASCII codes.
-          f << ' ' << int(pixel.red())
-	    << ' ' << int(pixel.green())
-	    << ' ' << int(pixel.blue());
+  // Write the pixels of image to f in top-to-bottom order, following
+  // a header written by ppm_write_header(...), using scratch.
+  void ppm_write_payload(std::ostream& f,
+			 const true_color_view& image,
+			 bool binary_samples,
+			 ppm_scratch& scratch) {
+    if (binary_samples) {
+      // Binary, so three unsigned bytes per pixel, which is exactly
+      // how true_color_rgb is laid out in memory. Note that we are
+      // forced into a rather barbaric typecast here, in order to
+      // ensure that f.write(...) does not despoil the most
+      // significant bit of our bytes.
+      const std::size_t row_bytes = 3 * std::size_t(image.width());
+      if (image.is_contiguous()) {
+	// The whole frame in one write.
+	f.write((const char*) image.data(), row_bytes * image.height());
+      } else {
+	for (int y = 0; y < image.height(); ++y) {
+	  f.write((const char*) image.row(y), row_bytes);
 	}
       }
-      // The standard specifies that no line should be longer than 70
-      // characters. We play it safe and write only one pixel per
-      // line.
-      if (!binary_samples) {
-	f << '\n';
+    } else {
+      // Text. The standard specifies that no line should be longer
+      // than 70 characters. We play it safe and write only one pixel
+      // per line. Each row is formatted into the buffer, which holds
+      // the longest possible row, and written at once.
+      std::vector<char>& buffer = scratch.text;
+      buffer.resize(PPM_MAX_TEXT_PIXEL_CHARS * std::size_t(image.width()));
+      for (int y = 0; y < image.height(); ++y) {
+	char* end = ppm_format_text_row(buffer.data(),
+					reinterpret_cast<const uint8_t*>(image.row(y)),
+					image.width());
+	f.write(buffer.data(), end - buffer.data());
       }
     }
+  }
+
+  // Write the pixels of an HDR image to f like ppm_write_payload(...)
+  // above, following a header with maxval 65535. Components are
+  // clamped to [0, 1] and scaled to two-byte samples, which are
+  // written most-significant byte first.
+  void ppm_write_payload(std::ostream& f,
+			 const hdr_view& image,
+			 bool binary_samples,
+			 ppm_scratch& scratch) {
+    const std::size_t row_samples = 3 * std::size_t(image.width());
+    std::vector<uint16_t>& samples = scratch.samples;
+    std::vector<char>& buffer = scratch.text;
+    samples.resize(row_samples);
+    buffer.resize(binary_samples
+		  ? 2 * row_samples
+		  : PPM_MAX_TEXT_PIXEL_CHARS * std::size_t(image.width()));
+    for (int y = 0; y < image.height(); ++y) {
+      const float* components = reinterpret_cast<const float*>(image.row(y));
+      for (std::size_t i = 0; i < row_samples; ++i) {
+	samples[i] = ppm_hdr_sample(components[i]);
+      }
+      char* end;
+      if (binary_samples) {
+	end = buffer.data();
+	for (std::size_t i = 0; i < row_samples; ++i) {
+	  *end++ = samples[i] >> 8;
+	  *end++ = samples[i] & 0xFF;
+	}
+      } else {
+	end = ppm_format_text_row(buffer.data(), samples.data(), image.width());
+      }
+      f.write(buffer.data(), end - buffer.data());
+    }
+  }
+
+  // Write image to a PPM file at path; see ppm_write(...) below.
+  template <typename color_depth>
+  bool ppm_write_file(const input_view<color_depth>& image,
+		      const std::string& path,
+		      bool binary_samples) {
+
+    // Writing is more straightforward since we don't need to deal
+    // with comments or format checking, so we present it first.
+
+    // Open the file for writing, or fail.
+    std::ofstream f;
+    if (binary_samples) {
+      f.open(path, std::ios_base::binary);
+    } else {
+      f.open(path);
+    }
+    if (!f) {
+      return false;
+    }
+
+    // Image header, then pixels.
+    const int maxval = std::is_same<color_depth, hdr_color_depth>::value ? 65535 : 255;
+    ppm_write_header(f, image.width(), image.height(), binary_samples, maxval);
+    ppm_scratch scratch;
+    ppm_write_payload(f, image, binary_samples, scratch);
 
     // Close the file or fail.
     if (!f) {
@@ -107,21 +236,611 @@ namespace gfx {
     return true;
   }
 
-  // Read a PPM file at path. This function can decode both
-  // binary/raw/P6 and textual/ASCII/P3 PPM variants. On success, fill
-  // result with the contents of the image file and return true. On
-  // failure, make result empty and return false. Failure conditions
-  // include file-not-found, I/O error, and a file that is not in
-  // proper PPM format.
-  bool ppm_read(true_color_image& result,
-		const std::string& path) {
+  // Write image to a PPM file at path. image may be a whole
+  // true_color_image or a true_color_view of part of one. When
+  // binary_samples is true, use binary samples (aka "raw" or "P6"
+  // mode). This is more space-efficient so is the default
+  // behavior. When binary_samples is false, use human-readable text
+  // samples (aka "ASCII" or "P3" mode). Return true on success, or
+  // false on I/O error.
+  bool ppm_write(const true_color_view& image,
+		 const std::string& path,
+		 bool binary_samples = true) {
+    return ppm_write_file<true_color_depth>(image, path, binary_samples);
+  }
 
-    // Open the file or fail.
-    std::ifstream f(path, std::ios_base::binary);
-    if (!f) {
-      result.clear();
+  // Write an hdr_image, or an hdr_view of part of one, to a PPM file
+  // at path like ppm_write(...) above, with maxval 65535 so that 16
+  // bits of each component are kept.
+  bool ppm_write(const hdr_view& image,
+		 const std::string& path,
+		 bool binary_samples = true) {
+    return ppm_write_file<hdr_color_depth>(image, path, binary_samples);
+  }
+
+  // Read the binary (P6) pixel payload of a PPM file from f into
+  // result, which has already been resized to the image
+  // dimensions. maxval is the maximum sample value from the
+  // header. Return true on success, or false on I/O error or a sample
+  // greater than maxval.
+  //
+  // This works in bulk rather than sample by sample. A true_color_rgb
+  // is exactly three bytes and image rows are contiguous, so one-byte
+  // samples are read straight into the pixel storage with a single
+  // read and, when maxval is not 255, rescaled in place through a
+  // lookup table. Two-byte samples are read one row at a time into
+  // scratch.bytes .
+  bool ppm_read_binary_payload(true_color_image& result,
+			       std::istream& f,
+			       int maxval,
+			       ppm_scratch& scratch) {
+
+    assert(!result.empty());
+    assert((maxval > 0) && (maxval < 65536));
+
+    const std::size_t row_samples = 3 * std::size_t(result.width());
+
+    if (maxval < 256) {
+      // One-byte samples. As with ppm_write, we need to resort to a
+      // vulgar typecast to preserve the sign bit.
+      uint8_t* samples = reinterpret_cast<uint8_t*>(result.data());
+      const std::size_t count = row_samples * result.height();
+      f.read((char*) samples, count);
+      if (!f) {
+	return false;
+      }
+
+      if (maxval != 255) {
+	// Normalize from [0, maxval] to [0, 255] the same way as
+	// textual samples, flagging out-of-range samples with -1.
+	int normalized[256];
+	for (int raw = 0; raw < 256; ++raw) {
+	  normalized[raw] = (raw <= maxval) ? (raw * 255) / maxval : -1;
+	}
+	for (std::size_t i = 0; i < count; ++i) {
+	  int sample = normalized[samples[i]];
+	  if (sample < 0) {
+	    return false;
+	  }
+	  samples[i] = sample;
+	}
+      }
+    } else {
+      // Two-byte samples, most-significant byte first.
+      std::vector<uint8_t>& bytes = scratch.bytes;
+      bytes.resize(2 * row_samples);
+      for (int y = 0; y < result.height(); ++y) {
+	f.read((char*) bytes.data(), bytes.size());
+	if (!f) {
+	  return false;
+	}
+	uint8_t* samples = reinterpret_cast<uint8_t*>(result.row(y));
+	for (std::size_t i = 0; i < row_samples; ++i) {
+	  // Note that we cast to int before shifting, because
+	  // otherwise we would shift a uint8_t left 8 times which
+	  // always yields 0.
+	  int raw_sample = (int(bytes[2 * i]) << 8) | int(bytes[2 * i + 1]);
+	  if (raw_sample > maxval) {
+	    return false;
+	  }
+	  samples[i] = (raw_sample * 255) / maxval;
+	}
+      }
+    }
+
+    return true;
+  }
+
+  // An incremental parser for textual (P3) samples. Characters are
+  // fed to scan(...) in arbitrarily sized pieces, typically
+  // consecutive blocks of a large read buffer, and a sample may span
+  // two pieces. Digits, whitespace, and '#' comments running to the
+  // end of the line are all handled in the same pass over the
+  // characters.
+  class ppm_text_scanner {
+  public:
+
+    // Create a scanner for samples in [0, maxval].
+    explicit ppm_text_scanner(int maxval)
+      : _maxval(maxval),
+	_value(0),
+	_in_number(false),
+	_in_comment(false) {
+      assert((maxval > 0) && (maxval < 65536));
+    }
+
+    // Scan the characters [begin, end), which continue where the
+    // previous call left off. Write each complete sample to *out++,
+    // stopping once out reaches out_end. uint8_t samples are
+    // normalized from [0, maxval] to [0, 255] exactly like ppm_read
+    // always has, and uint16_t samples are stored as they are. begin
+    // is advanced past the characters consumed. Return false if the
+    // input is malformed: a character that is not a digit,
+    // whitespace, or part of a comment, or a sample greater than
+    // maxval.
+    template <typename sample_type>
+    bool scan(const char*& begin,
+	      const char* end,
+	      sample_type*& out,
+	      sample_type* out_end) {
+
+      // Work on local copies of the state. Stores through out could
+      // otherwise alias the members and force a reload per character.
+      sample_type* o = out;
+      const int maxval = _maxval;
+      int value = _value;
+      bool in_number = _in_number, in_comment = _in_comment, ok = true;
+
+      const char* p = begin;
+      const char* next_block = p;
+      while ((p != end) && (o != out_end)) {
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+	// Fastest path, between samples: whole blocks of digits and
+	// whitespace. After it stops, the paths below take the next
+	// block one sample or character at a time.
+	if (!in_number && !in_comment && (p >= next_block)) {
+	  const char* blocks = p;
+	  if (!scan_blocks(p, end, o, out_end, maxval)) {
+	    ok = false;
+	    break;
+	  }
+	  next_block = p + BLOCK_SIZE;
+	  if (p != blocks) {
+	    continue;
+	  }
+	}
+
+	// Fast path, between samples with at least 8 characters left:
+	// classify all 8 bytes of a word at once. A run of whitespace is
+	// skipped whole, and a sample is converted without a branch per
+	// digit, together with the whitespace after it. Runs of 8 or
+	// more digits, comments, and anything malformed are left to the
+	// slow path.
+	if (!in_number && !in_comment && ((end - p) >= 8)) {
+	  uint64_t word;
+	  std::memcpy(&word, p, 8);
+	  const uint64_t spaces = space_bytes(word);
+	  int length = leading_bytes(spaces);
+	  if (length != 0) {
+	    p += length;
+	    continue;
+	  }
+	  length = leading_bytes(digit_bytes(word));
+	  if ((length != 0) && (length != 8)) {
+	    // Shift out everything after the digits, leaving leading
+	    // zeros, then combine pairs, quads, and octets of digits.
+	    uint64_t digits = (word ^ 0x3030303030303030ULL) << (8 * (8 - length));
+	    digits = ((digits * 2561) >> 8) & 0x00FF00FF00FF00FFULL;
+	    digits = ((digits * 6553601) >> 16) & 0x0000FFFF0000FFFFULL;
+	    digits = (digits * 42949672960001ULL) >> 32;
+	    if (digits > uint64_t(maxval)) {
+	      ok = false;
+	      break;
+	    }
+	    store(o, digits, maxval);
+	    // The bytes shifted in from the top are not whitespace, so
+	    // this stops within the word.
+	    p += length + leading_bytes(spaces >> (8 * length));
+	    continue;
+	  }
+	}
+#endif
+
+	// Slow path, one character at a time.
+	char c = *p++;
+	if (in_comment) {
+	  in_comment = (c != '\n') && (c != '\r');
+	} else if ((c >= '0') && (c <= '9')) {
+	  value = value * 10 + (c - '0');
+	  if (value > maxval) {
+	    ok = false;
+	    break;
+	  }
+	  in_number = true;
+	} else {
+	  if (in_number) {
+	    store(o, value, maxval);
+	    value = 0;
+	    in_number = false;
+	  }
+	  if (c == '#') {
+	    in_comment = true;
+	  } else if (!is_space(c)) {
+	    ok = false;
+	    break;
+	  }
+	}
+      }
+
+      begin = p;
+      out = o;
+      _value = value;
+      _in_number = in_number;
+      _in_comment = in_comment;
+      return ok;
+    }
+
+    // Finish at the end of the input, writing the sample in progress,
+    // if any, when out has room for it.
+    template <typename sample_type>
+    void finish(sample_type*& out,
+		sample_type* out_end) {
+      if (_in_number && (out != out_end)) {
+	store(out, _value, _maxval);
+	_value = 0;
+	_in_number = false;
+      }
+    }
+
+  private:
+    int _maxval, _value;
+    bool _in_number, _in_comment;
+
+    // Whitespace as defined by isspace(...) in the "C" locale.
+    static bool is_space(char c) {
+      return (c == ' ') || ((c >= '\t') && (c <= '\r'));
+    }
+
+    // The bytes of word that are digits, or whitespace as in
+    // is_space(...), as the top bit of each byte. Each byte is
+    // classified exactly: the top bit is cleared before adding
+    // constants, so no carry crosses into the next byte.
+    static uint64_t digit_bytes(uint64_t word) {
+      const uint64_t high = 0x8080808080808080ULL,
+	low = word & ~high;
+      const uint64_t at_least_0 = low + 0x5050505050505050ULL,
+	above_9 = low + 0x4646464646464646ULL;
+      return at_least_0 & ~above_9 & ~word & high;
+    }
+    static uint64_t space_bytes(uint64_t word) {
+      const uint64_t high = 0x8080808080808080ULL,
+	low = word & ~high,
+	blank = low ^ 0x2020202020202020ULL;
+      const uint64_t not_blank = (blank + 0x7F7F7F7F7F7F7F7FULL) | blank,
+	at_least_tab = low + 0x7777777777777777ULL,
+	above_return = low + 0x7272727272727272ULL;
+      return (~not_blank | (at_least_tab & ~above_return)) & ~word & high;
+    }
+
+    // The number of consecutive bytes, from the first, flagged in a
+    // mask from digit_bytes(...) or space_bytes(...).
+    static int leading_bytes(uint64_t mask) {
+      const uint64_t unflagged = ~mask & 0x8080808080808080ULL;
+      return (unflagged == 0) ? 8 : (__builtin_ctzll(unflagged) / 8);
+    }
+
+    // Gather the top bit of each byte of a mask from digit_bytes(...)
+    // or space_bytes(...) into the low 8 bits, first byte lowest.
+    static uint64_t byte_bits(uint64_t mask) {
+      return ((mask >> 7) * 0x0102040810204080ULL) >> 56;
+    }
+
+    static const int BLOCK_SIZE = 64;
+
+    // Classify the BLOCK_SIZE characters at p, setting bit i of
+    // digits or spaces when character i is a digit or whitespace.
+    static void classify_block(const char* p,
+			       uint64_t& digits,
+			       uint64_t& spaces) {
+      digits = 0;
+      spaces = 0;
+#if GFX_SIMD_X86
+      // Every x86-64 CPU has SSE2, which classifies 16 characters at
+      // a time with a few compares.
+      const __m128i zero = _mm_set1_epi8('0'),
+	nine = _mm_set1_epi8(9),
+	blank = _mm_set1_epi8(' '),
+	tab = _mm_set1_epi8('\t'),
+	four = _mm_set1_epi8('\r' - '\t');
+      for (int i = 0; i < BLOCK_SIZE; i += 16) {
+	const __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i)),
+	  digit = _mm_sub_epi8(chars, zero),
+	  control = _mm_sub_epi8(chars, tab);
+	const __m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(digit, nine), digit),
+	  is_space = _mm_or_si128(_mm_cmpeq_epi8(chars, blank),
+				  _mm_cmpeq_epi8(_mm_min_epu8(control, four), control));
+	digits |= uint64_t(uint16_t(_mm_movemask_epi8(is_digit))) << i;
+	spaces |= uint64_t(uint16_t(_mm_movemask_epi8(is_space))) << i;
+      }
+#else
+      for (int i = 0; i < BLOCK_SIZE; i += 8) {
+	uint64_t word;
+	std::memcpy(&word, p + i, 8);
+	digits |= byte_bits(digit_bytes(word)) << i;
+	spaces |= byte_bits(space_bytes(word)) << i;
+      }
+#endif
+    }
+
+    // Scan whole blocks of BLOCK_SIZE characters from begin, which is
+    // between samples, for as long as they hold only digits and
+    // whitespace, runs of at most 8 digits, and samples that fit
+    // before out_end. Each block is classified into one bit per
+    // character, a block ahead of the one being converted, and every
+    // sample is found from those bits, so neither the blocks nor the
+    // samples in them wait on one another. begin and out are advanced
+    // past what was scanned, which ends between samples. Return false
+    // if a sample is greater than maxval.
+    template <typename sample_type>
+    static bool scan_blocks(const char*& begin,
+			    const char* end,
+			    sample_type*& out,
+			    sample_type* out_end,
+			    int maxval) {
+      const char* p = begin;
+      sample_type* o = out;
+      if ((end - p) < 2 * BLOCK_SIZE) {
+	return true;
+      }
+
+      uint64_t digits, spaces;
+      classify_block(p, digits, spaces);
+      // Whether the previous block ended within a sample, which has
+      // already been converted.
+      uint64_t carry = 0;
+      for (; (end - p) >= 2 * BLOCK_SIZE; p += BLOCK_SIZE) {
+	uint64_t next_digits, next_spaces;
+	classify_block(p + BLOCK_SIZE, next_digits, next_spaces);
+	uint64_t starts = digits & ~((digits << 1) | carry);
+	if (((digits | spaces) != ~uint64_t(0))
+	    || (std::size_t(__builtin_popcountll(starts)) > std::size_t(out_end - o))) {
+	  break;
+	}
+	for (; starts != 0; starts &= starts - 1) {
+	  const int start = __builtin_ctzll(starts);
+	  const uint64_t run = ~((digits >> start) | ((next_digits << 1) << (63 - start)));
+	  const int length = (run == 0) ? 64 : __builtin_ctzll(run);
+	  if (length > 8) {
+	    begin = p + start;
+	    out = o;
+	    return true;
+	  }
+	  // Shift out everything after the digits, leaving leading
+	  // zeros, then combine pairs, quads, and octets of digits.
+	  uint64_t value;
+	  std::memcpy(&value, p + start, 8);
+	  value = (value ^ 0x3030303030303030ULL) << (8 * (8 - length));
+	  value = ((value * 2561) >> 8) & 0x00FF00FF00FF00FFULL;
+	  value = ((value * 6553601) >> 16) & 0x0000FFFF0000FFFFULL;
+	  value = (value * 42949672960001ULL) >> 32;
+	  if (value > uint64_t(maxval)) {
+	    return false;
+	  }
+	  store(o, value, maxval);
+	}
+	carry = digits >> 63;
+	digits = next_digits;
+	spaces = next_spaces;
+      }
+
+      // Step over the rest of a sample that crossed into this block.
+      begin = p + (carry ? __builtin_ctzll(~digits) : 0);
+      out = o;
+      return true;
+    }
+
+    static void store(uint8_t*& out, int value, int maxval) {
+      *out++ = (maxval == 255) ? value : (value * 255) / maxval;
+    }
+    static void store(uint16_t*& out, int value, int) {
+      *out++ = value;
+    }
+  };
+
+  // Reads textual (P3) samples from a stream in large blocks, and
+  // scans their characters directly rather than extracting each
+  // sample with operator>>. Samples may be read in any number of
+  // pieces, such as one row at a time, and the block buffer carries
+  // over between them, so the stream is generally read past the last
+  // sample requested.
+  class ppm_text_reader {
+  public:
+
+    // Read samples in [0, maxval] from f, which is positioned at the
+    // start of the payload.
+    ppm_text_reader(std::istream& f,
+		    int maxval)
+      : _f(f),
+	_scanner(maxval),
+	_buffer(BUFFER_SIZE),
+	_next(_buffer.data()),
+	_end(_buffer.data()) { }
+
+    // Fill [out, out_end) with the next samples, which are uint8_t
+    // or uint16_t; see ppm_text_scanner::scan(...). Return true on
+    // success, or false on I/O error, malformed input, or too few
+    // samples.
+    template <typename sample_type>
+    bool read(sample_type* out,
+	      sample_type* out_end) {
+      while (out != out_end) {
+	if (_next == _end) {
+	  if (!_f) {
+	    // End of file.
+	    _scanner.finish(out, out_end);
+	    break;
+	  }
+	  _f.read(_buffer.data(), BUFFER_SIZE);
+	  if (_f.bad()) {
+	    return false;
+	  }
+	  _next = _buffer.data();
+	  _end = _next + _f.gcount();
+	}
+	if (!_scanner.scan(_next, _end, out, out_end)) {
+	  return false;
+	}
+      }
+      return out == out_end;
+    }
+
+  private:
+    static const std::size_t BUFFER_SIZE = 1 << 16;
+
+    std::istream& _f;
+    ppm_text_scanner _scanner;
+    std::vector<char> _buffer;
+    const char* _next;
+    const char* _end;
+  };
+
+  // Count the textual (P3) samples in [begin, end), which must start
+  // outside of any sample or comment: the runs of digits that are not
+  // part of a comment. Malformed characters are not detected here.
+  std::size_t ppm_count_text_samples(const char* begin,
+				     const char* end) {
+    std::size_t count = 0;
+    bool in_number = false, in_comment = false;
+    for (const char* p = begin; p != end; ++p) {
+      char c = *p;
+      if (in_comment) {
+	in_comment = (c != '\n') && (c != '\r');
+      } else if ((c >= '0') && (c <= '9')) {
+	count += !in_number;
+	in_number = true;
+      } else {
+	in_number = false;
+	in_comment = (c == '#');
+      }
+    }
+    return count;
+  }
+
+  // The number of characters of textual (P3) payload in each chunk
+  // that ppm_parse_text_samples(...) parses on its own.
+  const std::size_t PPM_TEXT_CHUNK_SIZE = 1 << 20;
+
+  // Parse the textual (P3) samples in [begin, end) into [out, out +
+  // count) according to policy (see gfx::execution_policy), with
+  // results identical to reading them with one ppm_text_reader: the
+  // same samples, and the same failures for malformed input or too few
+  // samples, with anything after the last sample ignored. Return true
+  // on success.
+  //
+  // The text is split into chunks of about chunk_size characters, each
+  // starting just after a newline. A newline ends any sample or
+  // comment, so every chunk can be scanned independently. A first pass
+  // counts the samples in each chunk; the prefix sums of those counts
+  // give each chunk's offset in out, and a second pass parses the
+  // chunks straight into place. The chunks depend only on the text, so
+  // the work of both passes is split the same way on any number of
+  // threads.
+  template <typename sample_type>
+  bool ppm_parse_text_samples(const char* begin,
+			      const char* end,
+			      int maxval,
+			      sample_type* out,
+			      std::size_t count,
+			      const execution_policy& policy,
+			      std::size_t chunk_size = PPM_TEXT_CHUNK_SIZE) {
+
+    assert(chunk_size > 0);
+
+    // Chunk boundaries.
+    const std::size_t size = end - begin;
+    const int chunks = int(std::max<std::size_t>(1, (size + chunk_size - 1) / chunk_size));
+    std::vector<const char*> bounds(1, begin);
+    for (int i = 1; i < chunks; ++i) {
+      const char* split = std::max(bounds.back(), begin + chunk_size * i);
+      split = std::find(split, end, '\n');
+      bounds.push_back((split == end) ? end : split + 1);
+    }
+    bounds.push_back(end);
+
+    // Count, then place.
+    std::vector<std::size_t> offsets(chunks + 1, 0);
+    for_each_band(policy, chunks, 1, [&](int i, int) {
+	offsets[i + 1] = ppm_count_text_samples(bounds[i], bounds[i + 1]);
+      });
+    for (int i = 0; i < chunks; ++i) {
+      offsets[i + 1] += offsets[i];
+    }
+    if (offsets[chunks] < count) {
+      return false;
+    }
+
+    // Parse. Chunks wholly after the last sample are skipped.
+    std::vector<char> chunk_ok(chunks, true);
+    for_each_band(policy, chunks, 1, [&](int i, int) {
+	if (offsets[i] < count) {
+	  ppm_text_scanner scanner(maxval);
+	  const char* p = bounds[i];
+	  sample_type* chunk_out = out + offsets[i];
+	  sample_type* chunk_end = out + std::min(offsets[i + 1], count);
+	  chunk_ok[i] = scanner.scan(p, bounds[i + 1], chunk_out, chunk_end);
+	  scanner.finish(chunk_out, chunk_end);
+	  chunk_ok[i] = chunk_ok[i] && (chunk_out == chunk_end);
+	}
+      });
+    return std::find(chunk_ok.begin(), chunk_ok.end(), false) == chunk_ok.end();
+  }
+
+  // Payloads with fewer samples than this are always parsed on one
+  // thread.
+  const std::size_t PPM_PARALLEL_TEXT_SAMPLES = 1 << 20;
+
+  // Read the textual (P3) pixel payload of a PPM file from f into
+  // result, which has already been resized to the image
+  // dimensions. maxval is the maximum sample value from the
+  // header. Return true on success, or false on I/O error, malformed
+  // input (see ppm_text_scanner), or too few samples. Anything after
+  // the last sample is ignored.
+  //
+  // With a parallel policy (see gfx::execution_policy), by default
+  // the shared default_thread_pool(), payloads of at least
+  // parallel_samples samples are read into memory whole and parsed by
+  // ppm_parse_text_samples(...); otherwise they are streamed through a
+  // ppm_text_reader.
+  bool ppm_read_text_payload(true_color_image& result,
+			     std::istream& f,
+			     int maxval,
+			     const execution_policy& policy = parallel(),
+			     std::size_t parallel_samples = PPM_PARALLEL_TEXT_SAMPLES) {
+    assert(!result.empty());
+    uint8_t* out = reinterpret_cast<uint8_t*>(result.data());
+    const std::size_t count = 3 * std::size_t(result.width()) * result.height();
+
+    if (!policy.is_parallel() || (count < parallel_samples)) {
+      return ppm_text_reader(f, maxval).read(out, out + count);
+    }
+
+    // Read the rest of the stream.
+    std::vector<char> text;
+    std::size_t size = 0;
+    do {
+      text.resize(std::max<std::size_t>(2 * size, 1 << 16));
+      f.read(text.data() + size, text.size() - size);
+      size += f.gcount();
+    } while (f);
+    if (f.bad()) {
       return false;
     }
+    return ppm_parse_text_samples(text.data(), text.data() + size, maxval, out, count, policy);
+  }
+
+  // The header of a PPM file: everything before the first sample.
+  struct ppm_header {
+    int width, height, maxval;
+
+    // True for binary/raw/P6 samples, false for textual/ASCII/P3.
+    bool binary_samples;
+
+    // Offset of the first byte of the pixel payload from the start
+    // of the stream, or -1 when the stream cannot report positions
+    // (such as a pipe).
+    std::streamoff payload_offset;
+  };
+
+  // Parse a PPM header from f, which must be positioned at the
+  // beginning of the magic string. On success, fill header, leave f
+  // positioned at the first byte of the payload, and return true. On
+  // failure return false; failure conditions include I/O error, a
+  // magic string other than "P3" or "P6", and invalid dimensions or
+  // maxval. This is the one header parser that every PPM reader in
+  // this module goes through.
+  bool ppm_read_header(std::istream& f,
+		       ppm_header& header) {
 
     // Helper function to skip whitespace characters in f.
     auto skip_whitespace = [&]() {
@@ -159,8 +878,6 @@ namespace gfx {
       char magic_cstr[3];
       f.read(magic_cstr, 2);
       if (!f) {
-	result.clear();
-	f.close();
 	return false;
       }
       magic.assign(magic_cstr, 2);
@@ -174,8 +891,6 @@ namespace gfx {
       binary_samples = false;
     } else {
       // Fail.
-      result.clear();
-      f.close();
       return false;
     }
 
@@ -210,67 +925,177 @@ namespace gfx {
 	(maxval >= 65536) ||
 	(!isspace(single_whitespace))) {
       // Nope, fail.
-      f.close();
       return false;
     }
 
-    // Now that we know we have legitimate width and height, resize
-    // result.
-    result.resize(width, height);
-
-    // Read pixels in top-to-bottom order.
-    for (int y = 0; y < height; ++y) {
-      for (int x = 0; x < width; ++x) {
-	// Read the three RGB components.
-	for (int s = 0; s < 3; ++s) {
-	  // We will initialize raw_sample to an intensity value
-	  // [0, 255], either by reading a binary sample or textual
-	  // sample.
-	  int raw_sample;
-
-	  // Decide how to read the sample.
-	  if (binary_samples) {
-	    if (maxval < 256) {
-	      // One-byte sample. As with ppm_write, we need to resort
-	      // to a vulgar typecast to preserve the sign bit.
-	      uint8_t byte[1];
-	      f.read((char*) byte, 1);
-	      raw_sample = byte[0];
-	      assert((raw_sample >= 0) && (raw_sample <= 255));
-	    } else {
-              // Two-byte sample, including another typecast.
-	      uint8_t bytes[2];
-	      f.read((char*) bytes, 2);
-	      // The most-significant byte comes first. Note that we
-	      // cast to int before shifting, because otherwise we
-	      // would shift a uint8_t left 8 times which always
-	      // yields 0.
-	      raw_sample = (int(bytes[0]) << 8) | int(bytes[1]);
-	      assert((raw_sample >= 0) && (raw_sample <= 0xFFFF));
-	    }
-	  } else {
-	    // text samples
-	    f >> raw_sample;
-	  }
+    // Success.
+    header.width = width;
+    header.height = height;
+    header.maxval = maxval;
+    header.binary_samples = binary_samples;
+    header.payload_offset = f.tellg();
+    return true;
+  }
+
+  // Read the pixel payload of a PPM file from f into result, an HDR
+  // image which has already been resized to the image dimensions
+  // given in header. Each sample is scaled from [0, header.maxval]
+  // straight to [0, 1], so two-byte samples keep all 16 bits rather
+  // than being reduced to 8 first. Return true on success, or false on
+  // I/O error, malformed input, or a sample greater than maxval.
+  //
+  // Rows are decoded into raw samples, with two-byte binary samples
+  // byte-swapped from most-significant-first, and then scaled, in
+  // simple loops over whole rows that the compiler can vectorize.
+  bool ppm_read_hdr_payload(hdr_image& result,
+			    std::istream& f,
+			    const ppm_header& header,
+			    ppm_scratch& scratch) {
+
+    assert(!result.empty());
+
+    const int maxval = header.maxval;
+    const std::size_t row_samples = 3 * std::size_t(result.width());
+    std::vector<uint16_t>& samples = scratch.samples;
+    std::vector<uint8_t>& bytes = scratch.bytes;
+    samples.resize(row_samples);
+    std::unique_ptr<ppm_text_reader> text;
+    if (header.binary_samples) {
+      bytes.resize(((maxval < 256) ? 1 : 2) * row_samples);
+    } else {
+      text.reset(new ppm_text_reader(f, maxval));
+    }
 
-	  // Normalize raw_sample from [0, maxval] to [0, 255]. Note
-	  // that we multiply before dividing since raw_sample/maval
-	  // is always either 0 or 1 due to integer division
-	  // truncation. Also, note that we are using int instead of
-	  // uint8_t so that the (raw_sample * 255) expression does
-	  // not overflow.
-	  int normalized_sample = (raw_sample * 255) / maxval;
-	  assert(normalized_sample >= 0);
-	  assert(normalized_sample <= 255);
-
-	  // Finally copy this intensity value into the image object.
-	  result.pixel(x, y)[s] = normalized_sample;
+    for (int y = 0; y < result.height(); ++y) {
+      if (!header.binary_samples) {
+	if (!text->read(samples.data(), samples.data() + row_samples)) {
+	  return false;
+	}
+      } else {
+	f.read((char*) bytes.data(), bytes.size());
+	if (!f) {
+	  return false;
+	}
+	int largest = 0;
+	if (maxval < 256) {
+	  for (std::size_t i = 0; i < row_samples; ++i) {
+	    samples[i] = bytes[i];
+	    largest |= samples[i];
+	  }
+	} else {
+	  for (std::size_t i = 0; i < row_samples; ++i) {
+	    samples[i] = (bytes[2 * i] << 8) | bytes[2 * i + 1];
+	    largest |= samples[i];
+	  }
 	}
+	// largest is at least the largest sample, so this check is
+	// only conclusive when it passes; otherwise look closer.
+	if ((largest > maxval) &&
+	    (*std::max_element(samples.begin(), samples.end()) > maxval)) {
+	  return false;
+	}
+      }
+
+      float* components = reinterpret_cast<float*>(result.row(y));
+      const float scale = maxval;
+      for (std::size_t i = 0; i < row_samples; ++i) {
+	components[i] = samples[i] / scale;
       }
     }
 
-    // If any of those I/O operations failed, the whole process fails.
+    return true;
+  }
+
+  // Read the pixel payload of a PPM file, whose header has already
+  // been read from f, into result, using scratch. Textual payloads are
+  // read into true color with ppm_read_text_payload(...), passing
+  // text_policy and parallel_text_samples; into HDR they are always
+  // parsed on the calling thread.
+  bool ppm_read_payload(true_color_image& result,
+			std::istream& f,
+			const ppm_header& header,
+			ppm_scratch& scratch,
+			const execution_policy& text_policy = parallel(),
+			std::size_t parallel_text_samples = PPM_PARALLEL_TEXT_SAMPLES) {
+    return header.binary_samples
+      ? ppm_read_binary_payload(result, f, header.maxval, scratch)
+      : ppm_read_text_payload(result, f, header.maxval, text_policy, parallel_text_samples);
+  }
+  bool ppm_read_payload(hdr_image& result,
+			std::istream& f,
+			const ppm_header& header,
+			ppm_scratch& scratch,
+			const execution_policy& = sequential(),
+			std::size_t = PPM_PARALLEL_TEXT_SAMPLES) {
+    return ppm_read_hdr_payload(result, f, header, scratch);
+  }
+
+  // Read only the header of the PPM file at path, without decoding
+  // any pixels, to learn its dimensions, maxval, sample kind, and
+  // payload offset. The header is parsed by ppm_read_header(...), the
+  // same parser ppm_read(...) uses, so the two always agree. Return
+  // true on success, or false on file-not-found, I/O error, or an
+  // invalid header; the payload is not checked.
+  bool ppm_probe(const std::string& path,
+		 ppm_header& header) {
+
+    // A small stream buffer, so that little more than the header is
+    // read from disk.
+    char buffer[256];
+    std::ifstream f;
+    f.rdbuf()->pubsetbuf(buffer, sizeof(buffer));
+    f.open(path, std::ios_base::binary);
+    return f &&
+      ppm_read_header(f, header) &&
+      (header.payload_offset >= 0);
+  }
+
+  // Read a PPM file at path. This function can decode both
+  // binary/raw/P6 and textual/ASCII/P3 PPM variants. On success, fill
+  // result with the contents of the image file and return true. On
+  // failure, make result empty and return false. Failure conditions
+  // include file-not-found, I/O error, and a file that is not in
+  // proper PPM format.
+  //
+  // result may be a true_color_image, in which case samples are
+  // normalized to [0, 255], or an hdr_image, in which case samples
+  // are scaled to [0, 1] without losing precision, so that a 16-bit
+  // file is read losslessly.
+  //
+  // Large textual files are parsed according to text_policy, by
+  // default on the shared default_thread_pool() (see
+  // ppm_read_text_payload(...)); parallel_text_samples sets from how
+  // many samples on.
+  template <typename color_depth>
+  bool ppm_read(image<color_depth>& result,
+		const std::string& path,
+		const execution_policy& text_policy = parallel(),
+		std::size_t parallel_text_samples = PPM_PARALLEL_TEXT_SAMPLES) {
+
+    // Open the file or fail.
+    std::ifstream f(path, std::ios_base::binary);
     if (!f) {
+      result.clear();
+      return false;
+    }
+
+    // Parse the header or fail.
+    ppm_header header;
+    if (!ppm_read_header(f, header)) {
+      result.clear();
+      f.close();
+      return false;
+    }
+
+    // Now that we know we have legitimate width and height, resize
+    // result.
+    result.resize(header.width, header.height);
+
+    // Read pixels in top-to-bottom order. If any of those I/O
+    // operations failed, or the payload is malformed, the whole
+    // process fails.
+    ppm_scratch scratch;
+    if (!ppm_read_payload(result, f, header, scratch, text_policy, parallel_text_samples)) {
       result.clear();
       f.close();
       return false;
@@ -280,4 +1105,682 @@ namespace gfx {
     f.close();
     return true;
   }
+
+  // Reads a PPM file one row at a time, so that files of any size can
+  // be processed in memory proportional to their width. Both binary
+  // (P6) and textual (P3) files are supported, with the same
+  // normalization and error checking as ppm_read(...).
+  //
+  //     gfx::ppm_row_reader reader(in_path);
+  //     gfx::ppm_row_writer writer(out_path, reader.width(), reader.height());
+  //     gfx::true_color_image row, filtered;
+  //     while (reader.read_row(row)) {
+  //       grayscale(filtered, row);
+  //       writer.write_row(filtered);
+  //     }
+  //     bool ok = reader.done() && writer.close();
+  class ppm_row_reader {
+  public:
+
+    // Open the PPM file at path and read its header. Check failed()
+    // to see whether that succeeded.
+    explicit ppm_row_reader(const std::string& path)
+      : _f(path, std::ios_base::binary),
+	_y(0),
+	_failed(false) {
+      _failed = !_f || !ppm_read_header(_f, _header);
+      if (!_failed && !_header.binary_samples) {
+	_text.reset(new ppm_text_reader(_f, _header.maxval));
+      }
+    }
+
+    // A reader refers to its own stream, so cannot be copied or moved.
+    ppm_row_reader(const ppm_row_reader&) = delete;
+    ppm_row_reader& operator=(const ppm_row_reader&) = delete;
+
+    // Header accessors. These are only meaningful when !failed().
+    int width() const { return _header.width; }
+    int height() const { return _header.height; }
+    int maxval() const { return _header.maxval; }
+    bool binary_samples() const { return _header.binary_samples; }
+
+    // The y-coordinate of the next row read_row(...) will read.
+    int next_row() const { return _y; }
+
+    // True after the file could not be opened, its header was
+    // invalid, or reading a row failed.
+    bool failed() const { return _failed; }
+
+    // True when every row has been read successfully.
+    bool done() const { return !_failed && (_y == height()); }
+
+    // Read the next row into row, which is resized to width() x 1
+    // pixels; reusing the same row object avoids reallocating it. On
+    // success return true. Return false, leaving the contents of row
+    // unspecified, when every row has already been read or reading
+    // fails.
+    bool read_row(true_color_image& row) {
+      if (_failed || (_y == height())) {
+	return false;
+      }
+      row.resize(width(), 1);
+      bool ok;
+      if (_header.binary_samples) {
+	ok = ppm_read_binary_payload(row, _f, _header.maxval, _scratch);
+      } else {
+	uint8_t* out = reinterpret_cast<uint8_t*>(row.data());
+	ok = _text->read(out, out + 3 * std::size_t(width()));
+      }
+      if (!ok) {
+	_failed = true;
+	return false;
+      }
+      ++_y;
+      return true;
+    }
+
+  private:
+    std::ifstream _f;
+    ppm_header _header;
+    std::unique_ptr<ppm_text_reader> _text;
+    ppm_scratch _scratch;
+    int _y;
+    bool _failed;
+  };
+
+  // Writes a PPM file one row at a time, the counterpart of
+  // ppm_row_reader. The header is written when the file is opened, so
+  // the dimensions must be known in advance.
+  class ppm_row_writer {
+  public:
+
+    // Create the PPM file at path for a width x height image; see
+    // ppm_write(...) for binary_samples. width and height must be
+    // positive. Check failed() to see whether that succeeded.
+    ppm_row_writer(const std::string& path,
+		   int width,
+		   int height,
+		   bool binary_samples = true)
+      : _f(path, binary_samples ? std::ios_base::out | std::ios_base::binary : std::ios_base::out),
+	_width(width),
+	_height(height),
+	_y(0),
+	_binary_samples(binary_samples) {
+      assert(width > 0);
+      assert(height > 0);
+      ppm_write_header(_f, width, height, binary_samples);
+    }
+
+    // Closes the file if close() has not been called.
+    ~ppm_row_writer() {
+      if (_f.is_open()) {
+	_f.close();
+      }
+    }
+
+    int width() const { return _width; }
+    int height() const { return _height; }
+
+    // The y-coordinate of the next row write_row(...) will write.
+    int next_row() const { return _y; }
+
+    // True after an I/O error.
+    bool failed() const { return !_f; }
+
+    // Write row, which must be width() x 1 pixels, as the next row of
+    // the file. Return true on success, or false on I/O error or when
+    // every row has already been written.
+    bool write_row(const true_color_view& row) {
+      assert(row.width() == _width);
+      assert(row.height() == 1);
+      if (!_f || (_y == _height)) {
+	return false;
+      }
+      ppm_write_payload(_f, row, _binary_samples, _scratch);
+      ++_y;
+      return bool(_f);
+    }
+
+    // Close the file. Return true if every row was written without
+    // error, or false otherwise.
+    bool close() {
+      bool ok = _f && (_y == _height);
+      _f.close();
+      return ok && _f;
+    }
+
+  private:
+    std::ofstream _f;
+    int _width, _height, _y;
+    bool _binary_samples;
+    ppm_scratch _scratch;
+  };
+
+  // A std::streambuf that reads from and writes to a POSIX file
+  // descriptor, such as 0 for stdin, 1 for stdout, or either end of a
+  // pipe. Small reads and writes go through internal buffers, while
+  // large ones, like a whole frame of pixels, go straight to the file
+  // descriptor without an extra copy. The file descriptor is not
+  // closed on destruction; that is up to its owner.
+  class fd_streambuf : public std::streambuf {
+  public:
+
+    explicit fd_streambuf(int fd)
+      : _fd(fd),
+	_in(BUFFER_SIZE),
+	_out(BUFFER_SIZE) {
+      setg(_in.data(), _in.data(), _in.data());
+      setp(_out.data(), _out.data() + _out.size());
+    }
+
+    // Flushes buffered output.
+    ~fd_streambuf() {
+      sync();
+    }
+
+    fd_streambuf(const fd_streambuf&) = delete;
+    fd_streambuf& operator=(const fd_streambuf&) = delete;
+
+    int fd() const { return _fd; }
+
+  protected:
+
+    int_type underflow() override {
+      if (gptr() == egptr()) {
+	ssize_t count = read_some(_in.data(), _in.size());
+	if (count <= 0) {
+	  return traits_type::eof();
+	}
+	setg(_in.data(), _in.data(), _in.data() + count);
+      }
+      return traits_type::to_int_type(*gptr());
+    }
+
+    std::streamsize xsgetn(char* s, std::streamsize n) override {
+      // Whatever is buffered first, then read the rest directly.
+      std::streamsize total = std::min<std::streamsize>(n, egptr() - gptr());
+      std::memcpy(s, gptr(), total);
+      gbump(total);
+      while (total < n) {
+	ssize_t count = read_some(s + total, n - total);
+	if (count <= 0) {
+	  break;
+	}
+	total += count;
+      }
+      return total;
+    }
+
+    int_type overflow(int_type c) override {
+      if (!flush_output()) {
+	return traits_type::eof();
+      }
+      if (!traits_type::eq_int_type(c, traits_type::eof())) {
+	*pptr() = traits_type::to_char_type(c);
+	pbump(1);
+      }
+      return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+      if (n <= (epptr() - pptr())) {
+	std::memcpy(pptr(), s, n);
+	pbump(n);
+	return n;
+      }
+      // Too big to buffer, so write directly.
+      if (!flush_output() || !write_all(s, n)) {
+	return 0;
+      }
+      return n;
+    }
+
+    int sync() override {
+      return flush_output() ? 0 : -1;
+    }
+
+  private:
+    static const std::size_t BUFFER_SIZE = 1 << 16;
+
+    int _fd;
+    std::vector<char> _in, _out;
+
+    // Read up to n bytes, retrying after interruption by a signal.
+    ssize_t read_some(char* s, std::size_t n) {
+      ssize_t count;
+      do {
+	count = ::read(_fd, s, n);
+      } while ((count < 0) && (errno == EINTR));
+      return count;
+    }
+
+    // Write all n bytes, retrying after short writes and signals.
+    bool write_all(const char* s, std::size_t n) {
+      while (n > 0) {
+	ssize_t count = ::write(_fd, s, n);
+	if (count < 0) {
+	  if (errno == EINTR) {
+	    continue;
+	  }
+	  return false;
+	}
+	s += count;
+	n -= count;
+      }
+      return true;
+    }
+
+    bool flush_output() {
+      bool ok = write_all(pbase(), pptr() - pbase());
+      setp(_out.data(), _out.data() + _out.size());
+      return ok;
+    }
+  };
+
+  // Reads a sequence of binary (P6) PPM images concatenated in one
+  // stream, as the Netpbm format allows and as video tools emit when
+  // piping frames, from a file descriptor (stdin by default). Each
+  // frame's header is parsed by ppm_read_header, exactly like
+  // ppm_read(...).
+  //
+  // Reading every frame into the same image reuses its storage, so
+  // frames of a constant size cause no allocation:
+  //
+  //     gfx::ppm_stream_reader in;
+  //     gfx::ppm_stream_writer out;
+  //     gfx::true_color_image frame, filtered;
+  //     while (in.read_frame(frame)) {
+  //       edge_detect(filtered, frame);
+  //       out.write_frame(filtered);
+  //     }
+  //     bool ok = !in.failed() && !out.failed();
+  //
+  // The Netpbm specification only allows one image in a textual (P3)
+  // file, so a P3 frame is treated as an error.
+  class ppm_stream_reader {
+  public:
+
+    explicit ppm_stream_reader(int fd = 0)
+      : _buffer(fd),
+	_in(&_buffer),
+	_frames(0),
+	_failed(false) { }
+
+    // A reader refers to its own buffer, so cannot be copied or moved.
+    ppm_stream_reader(const ppm_stream_reader&) = delete;
+    ppm_stream_reader& operator=(const ppm_stream_reader&) = delete;
+
+    // The number of frames read successfully so far.
+    int frames() const { return _frames; }
+
+    // True after a malformed frame or an I/O error. Reaching the end
+    // of the stream between frames is not a failure.
+    bool failed() const { return _failed; }
+
+    // Read the next frame into frame, which may be a true_color_image
+    // or an hdr_image (see ppm_read(...)), resizing it to the frame's
+    // dimensions. Return true on success, or false at the end of the
+    // stream or on failure (see failed()). After a failure frame is
+    // empty and every later call returns false.
+    template <typename color_depth>
+    bool read_frame(image<color_depth>& frame) {
+      if (_failed) {
+	frame.clear();
+	return false;
+      }
+
+      // Whitespace between frames is tolerated, and the stream may
+      // end there.
+      while (isspace(_in.peek())) {
+	_in.get();
+      }
+      if (_in.peek() == std::istream::traits_type::eof()) {
+	return false;
+      }
+
+      ppm_header header;
+      if (!ppm_read_header(_in, header) ||
+	  !header.binary_samples) {
+	return fail(frame);
+      }
+      frame.resize(header.width, header.height);
+      if (!ppm_read_payload(frame, _in, header, _scratch)) {
+	return fail(frame);
+      }
+      ++_frames;
+      return true;
+    }
+
+  private:
+    fd_streambuf _buffer;
+    std::istream _in;
+    ppm_scratch _scratch;
+    int _frames;
+    bool _failed;
+
+    template <typename color_depth>
+    bool fail(image<color_depth>& frame) {
+      _failed = true;
+      frame.clear();
+      return false;
+    }
+  };
+
+  // Writes a sequence of binary (P6) PPM images to a file descriptor
+  // (stdout by default); the counterpart of ppm_stream_reader. Each
+  // frame is flushed as soon as it is written, so that a downstream
+  // process receives whole frames without delay.
+  class ppm_stream_writer {
+  public:
+
+    explicit ppm_stream_writer(int fd = 1)
+      : _buffer(fd),
+	_out(&_buffer),
+	_frames(0) { }
+
+    // A writer refers to its own buffer, so cannot be copied or moved.
+    ppm_stream_writer(const ppm_stream_writer&) = delete;
+    ppm_stream_writer& operator=(const ppm_stream_writer&) = delete;
+
+    // The number of frames written successfully so far.
+    int frames() const { return _frames; }
+
+    // True after an I/O error.
+    bool failed() const { return !_out; }
+
+    // Write frame, with maxval 255. Return true on success, or false
+    // on I/O error.
+    bool write_frame(const true_color_view& frame) {
+      return write_frame_with_maxval(frame, 255);
+    }
+
+    // Write an HDR frame, with maxval 65535. Return true on success,
+    // or false on I/O error.
+    bool write_frame(const hdr_view& frame) {
+      return write_frame_with_maxval(frame, 65535);
+    }
+
+  private:
+    fd_streambuf _buffer;
+    std::ostream _out;
+    ppm_scratch _scratch;
+    int _frames;
+
+    template <typename view_type>
+    bool write_frame_with_maxval(const view_type& frame, int maxval) {
+      assert(!frame.empty());
+      if (!_out) {
+	return false;
+      }
+      ppm_write_header(_out, frame.width(), frame.height(), true, maxval);
+      ppm_write_payload(_out, frame, true, _scratch);
+      _out.flush();
+      if (!_out) {
+	return false;
+      }
+      ++_frames;
+      return true;
+    }
+  };
+
+  // A binary (P6) PPM file with maxval 255, mapped into memory
+  // read-only. The payload of such a file has exactly the layout of
+  // true_color_rgb pixels, so view() exposes it as a true_color_view
+  // with no copy and no allocation. A mapped_ppm converts implicitly
+  // to a true_color_view, so it may be passed directly as the input
+  // of any filter.
+  //
+  // The view is only valid while the mapped_ppm stays open; moving a
+  // mapped_ppm transfers the mapping, and closing or destroying it
+  // unmaps the file. Like image, a mapped_ppm may be empty, which is
+  // the state after default construction, a failed open, or close().
+  class mapped_ppm {
+  public:
+
+    // Type aliases.
+    using color_depth = true_color_depth;
+    using rgb_type = true_color_rgb;
+
+    // Default constructor. Creates an empty mapped_ppm.
+    mapped_ppm()
+      : _mapping(nullptr),
+	_mapping_bytes(0) { }
+
+    // Map the PPM file at path; check empty() for failure.
+    explicit mapped_ppm(const std::string& path)
+      : mapped_ppm() {
+      open(path);
+    }
+
+    // Move constructor. other is left empty.
+    mapped_ppm(mapped_ppm&& other) noexcept
+      : _mapping(other._mapping),
+	_mapping_bytes(other._mapping_bytes),
+	_view(other._view) {
+      other._mapping = nullptr;
+      other._mapping_bytes = 0;
+      other._view = true_color_view();
+    }
+
+    // Move assignment. other is left empty.
+    mapped_ppm& operator=(mapped_ppm&& other) noexcept {
+      if (this != &other) {
+	close();
+	std::swap(_mapping, other._mapping);
+	std::swap(_mapping_bytes, other._mapping_bytes);
+	std::swap(_view, other._view);
+      }
+      return *this;
+    }
+
+    // A mapping is not copyable.
+    mapped_ppm(const mapped_ppm&) = delete;
+    mapped_ppm& operator=(const mapped_ppm&) = delete;
+
+    ~mapped_ppm() {
+      close();
+    }
+
+    // Map the PPM file at path, replacing any existing mapping. The
+    // header is parsed by ppm_probe(...), exactly as ppm_read does.
+    // Return true on success. On failure, leave this object empty
+    // and return false. Failure conditions include file-not-found,
+    // I/O error, a file that is not in proper PPM format, a textual
+    // (P3) file, maxval other than 255, and a truncated payload.
+    bool open(const std::string& path) {
+
+      close();
+
+      // Parse the header.
+      ppm_header header;
+      if (!ppm_probe(path, header) ||
+	  !header.binary_samples ||
+	  (header.maxval != 255)) {
+	return false;
+      }
+
+      // Map the whole file, and check that it holds the whole payload.
+      int fd = ::open(path.c_str(), O_RDONLY);
+      if (fd < 0) {
+	return false;
+      }
+      struct stat status;
+      const std::size_t payload_bytes = std::size_t(header.width) * header.height * sizeof(rgb_type);
+      if ((fstat(fd, &status) != 0) ||
+	  (std::size_t(status.st_size) < header.payload_offset + payload_bytes)) {
+	::close(fd);
+	return false;
+      }
+      void* mapping = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      ::close(fd);
+      if (mapping == MAP_FAILED) {
+	return false;
+      }
+
+      _mapping = mapping;
+      _mapping_bytes = status.st_size;
+      const rgb_type* origin = reinterpret_cast<const rgb_type*>(static_cast<const char*>(mapping) + header.payload_offset);
+      _view = true_color_view(origin, header.width, header.height, header.width);
+      return true;
+    }
+
+    // Unmap the file, if any, and become empty.
+    void close() {
+      if (_mapping != nullptr) {
+	munmap(_mapping, _mapping_bytes);
+	_mapping = nullptr;
+	_mapping_bytes = 0;
+	_view = true_color_view();
+      }
+    }
+
+    // Accessors.
+    bool empty() const { return _view.empty(); }
+    int width() const { return _view.width(); }
+    int height() const { return _view.height(); }
+    const true_color_view& view() const { return _view; }
+    operator const true_color_view&() const { return _view; }
+
+    // Return the pixel at (x, y); see image::pixel(...).
+    const rgb_type& pixel(int x, int y) const {
+      return _view.pixel(x, y);
+    }
+
+  private:
+    void* _mapping;
+    std::size_t _mapping_bytes;
+    true_color_view _view;
+  };
+
+  // Loads a list of PPM files on background threads, ahead of the
+  // thread that consumes them, so that decoding overlaps with whatever
+  // the consumer does with each image. Every file is read with
+  // ppm_read(...), and images are delivered strictly in path order.
+  //
+  // At most capacity decoded images wait to be delivered at any time;
+  // loader threads block until the consumer catches up, which bounds
+  // memory use. Buffers are recycled: next(image) swaps the decoded
+  // image into image, and image's previous storage is reused for a
+  // later file, so a sequence of same-sized files causes no
+  // allocation once the pipeline is full.
+  //
+  //     gfx::async_ppm_loader loader(paths);
+  //     gfx::true_color_image image, filtered;
+  //     while (loader.next(image)) {
+  //       box_blur(filtered, image, 5);
+  //       ...
+  //     }
+  class async_ppm_loader {
+  public:
+
+    // Start loading paths on thread_count threads, with at most
+    // capacity images decoded ahead. capacity and thread_count must
+    // be positive.
+    explicit async_ppm_loader(const std::vector<std::string>& paths,
+			      int capacity = 4,
+			      int thread_count = 2)
+      : _paths(paths),
+	_slots(capacity),
+	_next_load(0),
+	_next_delivery(0),
+	_stopping(false) {
+      assert(capacity > 0);
+      assert(thread_count > 0);
+      for (int i = 0; i < thread_count; ++i) {
+	_threads.emplace_back(&async_ppm_loader::load_loop, this);
+      }
+    }
+
+    // Stops loading, abandoning any files not yet delivered.
+    ~async_ppm_loader() {
+      {
+	std::lock_guard<std::mutex> lock(_mutex);
+	_stopping = true;
+      }
+      _changed.notify_all();
+      for (auto& thread : _threads) {
+	thread.join();
+      }
+    }
+
+    async_ppm_loader(const async_ppm_loader&) = delete;
+    async_ppm_loader& operator=(const async_ppm_loader&) = delete;
+
+    // The number of paths, and the number delivered by next(...) so
+    // far.
+    std::size_t size() const { return _paths.size(); }
+    std::size_t delivered() const { return _next_delivery; }
+
+    // Wait for the image of the next path in order. Return false once
+    // every path has been delivered. Otherwise swap the image into
+    // image and return true; image is empty when the file could not
+    // be read.
+    bool next(true_color_image& image) {
+      if (_next_delivery == _paths.size()) {
+	return false;
+      }
+      std::unique_lock<std::mutex> lock(_mutex);
+      slot& ready = _slots[_next_delivery % _slots.size()];
+      _changed.wait(lock, [&]() { return ready.loaded; });
+      std::swap(image, ready.image);
+      if (!ready.image.empty()) {
+	_recycled.push_back(std::move(ready.image));
+      }
+      ready.loaded = false;
+      ++_next_delivery;
+      lock.unlock();
+      _changed.notify_all();
+      return true;
+    }
+
+  private:
+    struct slot {
+      true_color_image image;
+      bool loaded = false;
+    };
+
+    const std::vector<std::string> _paths;
+
+    // File i is loaded into _slots[i % _slots.size()]. Images already
+    // delivered, whose storage can be reused, wait in _recycled.
+    std::vector<slot> _slots;
+    std::vector<true_color_image> _recycled;
+
+    std::size_t _next_load, _next_delivery;
+    bool _stopping;
+    std::mutex _mutex;
+    std::condition_variable _changed;
+    std::vector<std::thread> _threads;
+
+    void load_loop() {
+      std::unique_lock<std::mutex> lock(_mutex);
+      for (;;) {
+	// Backpressure: wait for a free slot.
+	_changed.wait(lock, [&]() {
+	    return _stopping ||
+	      (_next_load == _paths.size()) ||
+	      (_next_load < _next_delivery + _slots.size());
+	  });
+	if (_stopping || (_next_load == _paths.size())) {
+	  return;
+	}
+	std::size_t index = _next_load++;
+	true_color_image image;
+	if (!_recycled.empty()) {
+	  image = std::move(_recycled.back());
+	  _recycled.pop_back();
+	}
+
+	// Decode without holding the lock.
+	lock.unlock();
+	ppm_read(image, _paths[index]);
+	lock.lock();
+
+	slot& loaded = _slots[index % _slots.size()];
+	loaded.image = std::move(image);
+	loaded.loaded = true;
+	_changed.notify_all();
+      }
+    }
+  };
 }
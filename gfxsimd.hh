@@ -0,0 +1,347 @@
+///////////////////////////////////////////////////////////////////////////////
+// gfxsimd.hh
+//
+// Vectorized kernels for the hottest per-pixel loops of gfxfilter.hh .
+// Each kernel has a portable scalar version and, on x86 with GCC or
+// Clang, SSE2 and AVX2 versions. By default a kernel runs the widest
+// version the CPU supports, which is detected once at run time, so one
+// binary uses AVX2 where it is available and still runs everywhere
+// else. Every version computes bit-for-bit the same result as the
+// scalar one.
+//
+// The kernels work on rows of interleaved red, green, blue components,
+// which is how gfx::image stores its pixels. The filters in
+// gfxfilter.hh are the intended interface; use these directly only to
+// process rows of raw components.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#define GFX_SIMD_X86 1
+#include <immintrin.h>
+#else
+#define GFX_SIMD_X86 0
+#endif
+
+namespace gfx {
+
+  // The instruction sets a kernel can be run with, from narrowest to
+  // widest.
+  enum simd_level { SIMD_SCALAR = 0,
+		    SIMD_SSE2   = 1,
+		    SIMD_AVX2   = 2 };
+
+  // Return the widest simd_level that this CPU, and this build,
+  // supports.
+  simd_level detected_simd_level() {
+#if GFX_SIMD_X86
+    static const simd_level level = []() {
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("avx2") ? SIMD_AVX2 : SIMD_SSE2;
+    }();
+    return level;
+#else
+    return SIMD_SCALAR;
+#endif
+  }
+
+  // Return the gray intensity of one 8-bit pixel. weights holds the
+  // red, green and blue weights in 16-bit fixed point, where 65536 is
+  // 1, and they must add up to 65536. Each product keeps 8 fractional
+  // bits, and the sum is biased by the at most 2/256 that the three
+  // truncations can lose, so a pixel whose components are all v has
+  // gray intensity v.
+  uint8_t fixed_point_gray(uint8_t red, uint8_t green, uint8_t blue,
+			   const uint16_t* weights) {
+    uint32_t sum = (((uint32_t(red) << 8) * weights[0]) >> 16)
+      + (((uint32_t(green) << 8) * weights[1]) >> 16)
+      + (((uint32_t(blue) << 8) * weights[2]) >> 16);
+    return uint8_t((sum + 2) >> 8);
+  }
+
+  // Return the gray intensity of one floating-point pixel, the sum of
+  // its components times weights, added in red, green, blue order.
+  float float_gray(float red, float green, float blue,
+		   const float* weights) {
+    float r = red * weights[0], g = green * weights[1], b = blue * weights[2];
+#if GFX_SIMD_X86
+    // The vector kernels round each product, so keep the compiler from
+    // fusing these into the adds when it targets a CPU with FMA.
+    asm("" : "+x"(r), "+x"(g), "+x"(b));
+#endif
+    return (r + g) + b;
+  }
+
+#if GFX_SIMD_X86
+
+  // The SSE2 and AVX2 gray kernels take a block of whole pixels as
+  // three vectors a, b and c of interleaved components, and multiply
+  // every component by its weight. The sum of a pixel is then its first
+  // lane plus the next two. The sums for the first lanes are kept with
+  // a mask and copied into the two lanes after them, which leaves every
+  // component set to its pixel's gray intensity, already interleaved.
+  // The AVX2 kernels do the same to two blocks at once, one in each
+  // 128-bit half, because AVX2 byte shifts stay within halves.
+
+  // Set the components of 8-bit pixels [0, count) to their gray
+  // intensities, with SSE2. count must be a multiple of 8.
+  void gray_row_sse2(const uint8_t* source, uint8_t* destination, int count,
+		     const uint16_t* weights) {
+    const short r = short(weights[0]), g = short(weights[1]), b = short(weights[2]);
+    const __m128i zero = _mm_setzero_si128(),
+      bias = _mm_set1_epi16(2),
+      weights_a = _mm_setr_epi16(r, g, b, r, g, b, r, g),
+      weights_b = _mm_setr_epi16(b, r, g, b, r, g, b, r),
+      weights_c = _mm_setr_epi16(g, b, r, g, b, r, g, b),
+      first_a = _mm_setr_epi16(-1, 0, 0, -1, 0, 0, -1, 0),
+      first_b = _mm_setr_epi16(0, -1, 0, 0, -1, 0, 0, -1),
+      first_c = _mm_setr_epi16(0, 0, -1, 0, 0, -1, 0, 0);
+    for (int x = 0; x < count; x += 8) {
+      const uint8_t* in = source + 3 * x;
+      uint8_t* out = destination + 3 * x;
+
+      // 8 pixels, 24 components, each shifted left 8 bits into a 16-bit
+      // lane and multiplied by its weight.
+      __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in)),
+	high = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(in + 16));
+      __m128i a = _mm_mulhi_epu16(_mm_unpacklo_epi8(zero, low), weights_a),
+	b = _mm_mulhi_epu16(_mm_unpackhi_epi8(zero, low), weights_b),
+	c = _mm_mulhi_epu16(_mm_unpacklo_epi8(zero, high), weights_c);
+
+      // Each lane plus the next two.
+      __m128i sum_a = _mm_add_epi16(_mm_add_epi16(a, _mm_or_si128(_mm_srli_si128(a, 2), _mm_slli_si128(b, 14))),
+				    _mm_or_si128(_mm_srli_si128(a, 4), _mm_slli_si128(b, 12))),
+	sum_b = _mm_add_epi16(_mm_add_epi16(b, _mm_or_si128(_mm_srli_si128(b, 2), _mm_slli_si128(c, 14))),
+			      _mm_or_si128(_mm_srli_si128(b, 4), _mm_slli_si128(c, 12))),
+	sum_c = _mm_add_epi16(_mm_add_epi16(c, _mm_srli_si128(c, 2)), _mm_srli_si128(c, 4));
+
+      // The gray intensities, in the first lane of each pixel.
+      a = _mm_and_si128(_mm_srli_epi16(_mm_add_epi16(sum_a, bias), 8), first_a);
+      b = _mm_and_si128(_mm_srli_epi16(_mm_add_epi16(sum_b, bias), 8), first_b);
+      c = _mm_and_si128(_mm_srli_epi16(_mm_add_epi16(sum_c, bias), 8), first_c);
+
+      // Copied into the other two lanes.
+      __m128i gray_a = _mm_or_si128(a, _mm_or_si128(_mm_slli_si128(a, 2), _mm_slli_si128(a, 4))),
+	gray_b = _mm_or_si128(_mm_or_si128(b, _mm_or_si128(_mm_slli_si128(b, 2), _mm_slli_si128(b, 4))),
+			      _mm_or_si128(_mm_srli_si128(a, 14), _mm_srli_si128(a, 12))),
+	gray_c = _mm_or_si128(_mm_or_si128(c, _mm_or_si128(_mm_slli_si128(c, 2), _mm_slli_si128(c, 4))),
+			      _mm_or_si128(_mm_srli_si128(b, 14), _mm_srli_si128(b, 12)));
+
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(gray_a, gray_b));
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(out + 16), _mm_packus_epi16(gray_c, zero));
+    }
+  }
+
+  // gray_row_sse2 with AVX2, 16 pixels at a time. count must be a
+  // multiple of 16.
+  __attribute__((target("avx2")))
+  void gray_row_avx2(const uint8_t* source, uint8_t* destination, int count,
+		     const uint16_t* weights) {
+    const short r = short(weights[0]), g = short(weights[1]), b = short(weights[2]);
+    const __m256i zero = _mm256_setzero_si256(),
+      bias = _mm256_set1_epi16(2),
+      weights_a = _mm256_setr_epi16(r, g, b, r, g, b, r, g, r, g, b, r, g, b, r, g),
+      weights_b = _mm256_setr_epi16(b, r, g, b, r, g, b, r, b, r, g, b, r, g, b, r),
+      weights_c = _mm256_setr_epi16(g, b, r, g, b, r, g, b, g, b, r, g, b, r, g, b),
+      first_a = _mm256_setr_epi16(-1, 0, 0, -1, 0, 0, -1, 0, -1, 0, 0, -1, 0, 0, -1, 0),
+      first_b = _mm256_setr_epi16(0, -1, 0, 0, -1, 0, 0, -1, 0, -1, 0, 0, -1, 0, 0, -1),
+      first_c = _mm256_setr_epi16(0, 0, -1, 0, 0, -1, 0, 0, 0, 0, -1, 0, 0, -1, 0, 0);
+    for (int x = 0; x < count; x += 16) {
+      const uint8_t* in = source + 3 * x;
+      uint8_t* out = destination + 3 * x;
+
+      // Pixels [0, 8) in the low half, [8, 16) in the high half.
+      __m256i low = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in))),
+					    _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 24)), 1),
+	high = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(in + 16))),
+				       _mm_loadl_epi64(reinterpret_cast<const __m128i*>(in + 40)), 1);
+      __m256i a = _mm256_mulhi_epu16(_mm256_unpacklo_epi8(zero, low), weights_a),
+	b = _mm256_mulhi_epu16(_mm256_unpackhi_epi8(zero, low), weights_b),
+	c = _mm256_mulhi_epu16(_mm256_unpacklo_epi8(zero, high), weights_c);
+
+      __m256i sum_a = _mm256_add_epi16(_mm256_add_epi16(a, _mm256_or_si256(_mm256_srli_si256(a, 2), _mm256_slli_si256(b, 14))),
+				       _mm256_or_si256(_mm256_srli_si256(a, 4), _mm256_slli_si256(b, 12))),
+	sum_b = _mm256_add_epi16(_mm256_add_epi16(b, _mm256_or_si256(_mm256_srli_si256(b, 2), _mm256_slli_si256(c, 14))),
+				 _mm256_or_si256(_mm256_srli_si256(b, 4), _mm256_slli_si256(c, 12))),
+	sum_c = _mm256_add_epi16(_mm256_add_epi16(c, _mm256_srli_si256(c, 2)), _mm256_srli_si256(c, 4));
+
+      a = _mm256_and_si256(_mm256_srli_epi16(_mm256_add_epi16(sum_a, bias), 8), first_a);
+      b = _mm256_and_si256(_mm256_srli_epi16(_mm256_add_epi16(sum_b, bias), 8), first_b);
+      c = _mm256_and_si256(_mm256_srli_epi16(_mm256_add_epi16(sum_c, bias), 8), first_c);
+
+      __m256i gray_a = _mm256_or_si256(a, _mm256_or_si256(_mm256_slli_si256(a, 2), _mm256_slli_si256(a, 4))),
+	gray_b = _mm256_or_si256(_mm256_or_si256(b, _mm256_or_si256(_mm256_slli_si256(b, 2), _mm256_slli_si256(b, 4))),
+				 _mm256_or_si256(_mm256_srli_si256(a, 14), _mm256_srli_si256(a, 12))),
+	gray_c = _mm256_or_si256(_mm256_or_si256(c, _mm256_or_si256(_mm256_slli_si256(c, 2), _mm256_slli_si256(c, 4))),
+				 _mm256_or_si256(_mm256_srli_si256(b, 14), _mm256_srli_si256(b, 12)));
+
+      __m256i ab = _mm256_packus_epi16(gray_a, gray_b), cc = _mm256_packus_epi16(gray_c, zero);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm256_castsi256_si128(ab));
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(out + 16), _mm256_castsi256_si128(cc));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 24), _mm256_extracti128_si256(ab, 1));
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(out + 40), _mm256_extracti128_si256(cc, 1));
+    }
+  }
+
+  // Set the components of floating-point pixels [0, count) to their
+  // gray intensities, with SSE2. count must be a multiple of 4.
+  void gray_row_sse2(const float* source, float* destination, int count,
+		     const float* weights) {
+    const float r = weights[0], g = weights[1], b = weights[2];
+    const __m128 weights_a = _mm_setr_ps(r, g, b, r),
+      weights_b = _mm_setr_ps(g, b, r, g),
+      weights_c = _mm_setr_ps(b, r, g, b);
+    const __m128i first_a = _mm_setr_epi32(-1, 0, 0, -1),
+      first_b = _mm_setr_epi32(0, 0, -1, 0),
+      first_c = _mm_setr_epi32(0, -1, 0, 0);
+    for (int x = 0; x < count; x += 4) {
+      const float* in = source + 3 * x;
+      float* out = destination + 3 * x;
+
+      // 4 pixels, 12 components, each multiplied by its weight.
+      __m128i a = _mm_castps_si128(_mm_mul_ps(_mm_loadu_ps(in), weights_a)),
+	b = _mm_castps_si128(_mm_mul_ps(_mm_loadu_ps(in + 4), weights_b)),
+	c = _mm_castps_si128(_mm_mul_ps(_mm_loadu_ps(in + 8), weights_c));
+
+      // Each lane plus the next, plus the one after that.
+      __m128 sum_a = _mm_add_ps(_mm_add_ps(_mm_castsi128_ps(a),
+					   _mm_castsi128_ps(_mm_or_si128(_mm_srli_si128(a, 4), _mm_slli_si128(b, 12)))),
+				_mm_castsi128_ps(_mm_or_si128(_mm_srli_si128(a, 8), _mm_slli_si128(b, 8)))),
+	sum_b = _mm_add_ps(_mm_add_ps(_mm_castsi128_ps(b),
+				      _mm_castsi128_ps(_mm_or_si128(_mm_srli_si128(b, 4), _mm_slli_si128(c, 12)))),
+			   _mm_castsi128_ps(_mm_or_si128(_mm_srli_si128(b, 8), _mm_slli_si128(c, 8)))),
+	sum_c = _mm_add_ps(_mm_add_ps(_mm_castsi128_ps(c), _mm_castsi128_ps(_mm_srli_si128(c, 4))),
+			   _mm_castsi128_ps(_mm_srli_si128(c, 8)));
+
+      a = _mm_and_si128(_mm_castps_si128(sum_a), first_a);
+      b = _mm_and_si128(_mm_castps_si128(sum_b), first_b);
+      c = _mm_and_si128(_mm_castps_si128(sum_c), first_c);
+
+      __m128i gray_a = _mm_or_si128(a, _mm_or_si128(_mm_slli_si128(a, 4), _mm_slli_si128(a, 8))),
+	gray_b = _mm_or_si128(_mm_or_si128(b, _mm_or_si128(_mm_slli_si128(b, 4), _mm_slli_si128(b, 8))),
+			      _mm_or_si128(_mm_srli_si128(a, 12), _mm_srli_si128(a, 8))),
+	gray_c = _mm_or_si128(_mm_or_si128(c, _mm_or_si128(_mm_slli_si128(c, 4), _mm_slli_si128(c, 8))),
+			      _mm_or_si128(_mm_srli_si128(b, 12), _mm_srli_si128(b, 8)));
+
+      _mm_storeu_ps(out, _mm_castsi128_ps(gray_a));
+      _mm_storeu_ps(out + 4, _mm_castsi128_ps(gray_b));
+      _mm_storeu_ps(out + 8, _mm_castsi128_ps(gray_c));
+    }
+  }
+
+  // gray_row_sse2 with AVX2, 8 pixels at a time. count must be a
+  // multiple of 8.
+  __attribute__((target("avx2")))
+  void gray_row_avx2(const float* source, float* destination, int count,
+		     const float* weights) {
+    const float r = weights[0], g = weights[1], b = weights[2];
+    const __m256 weights_a = _mm256_setr_ps(r, g, b, r, r, g, b, r),
+      weights_b = _mm256_setr_ps(g, b, r, g, g, b, r, g),
+      weights_c = _mm256_setr_ps(b, r, g, b, b, r, g, b);
+    const __m256i first_a = _mm256_setr_epi32(-1, 0, 0, -1, -1, 0, 0, -1),
+      first_b = _mm256_setr_epi32(0, 0, -1, 0, 0, 0, -1, 0),
+      first_c = _mm256_setr_epi32(0, -1, 0, 0, 0, -1, 0, 0);
+    for (int x = 0; x < count; x += 8) {
+      const float* in = source + 3 * x;
+      float* out = destination + 3 * x;
+
+      // Pixels [0, 4) in the low half, [4, 8) in the high half.
+      __m256i a = _mm256_castps_si256(_mm256_mul_ps(_mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(in)),
+									  _mm_loadu_ps(in + 12), 1),
+						    weights_a)),
+	b = _mm256_castps_si256(_mm256_mul_ps(_mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(in + 4)),
+								   _mm_loadu_ps(in + 16), 1),
+					      weights_b)),
+	c = _mm256_castps_si256(_mm256_mul_ps(_mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(in + 8)),
+								   _mm_loadu_ps(in + 20), 1),
+					      weights_c));
+
+      __m256 sum_a = _mm256_add_ps(_mm256_add_ps(_mm256_castsi256_ps(a),
+						 _mm256_castsi256_ps(_mm256_or_si256(_mm256_srli_si256(a, 4), _mm256_slli_si256(b, 12)))),
+				   _mm256_castsi256_ps(_mm256_or_si256(_mm256_srli_si256(a, 8), _mm256_slli_si256(b, 8)))),
+	sum_b = _mm256_add_ps(_mm256_add_ps(_mm256_castsi256_ps(b),
+					    _mm256_castsi256_ps(_mm256_or_si256(_mm256_srli_si256(b, 4), _mm256_slli_si256(c, 12)))),
+			      _mm256_castsi256_ps(_mm256_or_si256(_mm256_srli_si256(b, 8), _mm256_slli_si256(c, 8)))),
+	sum_c = _mm256_add_ps(_mm256_add_ps(_mm256_castsi256_ps(c), _mm256_castsi256_ps(_mm256_srli_si256(c, 4))),
+			      _mm256_castsi256_ps(_mm256_srli_si256(c, 8)));
+
+      a = _mm256_and_si256(_mm256_castps_si256(sum_a), first_a);
+      b = _mm256_and_si256(_mm256_castps_si256(sum_b), first_b);
+      c = _mm256_and_si256(_mm256_castps_si256(sum_c), first_c);
+
+      __m256i gray_a = _mm256_or_si256(a, _mm256_or_si256(_mm256_slli_si256(a, 4), _mm256_slli_si256(a, 8))),
+	gray_b = _mm256_or_si256(_mm256_or_si256(b, _mm256_or_si256(_mm256_slli_si256(b, 4), _mm256_slli_si256(b, 8))),
+				 _mm256_or_si256(_mm256_srli_si256(a, 12), _mm256_srli_si256(a, 8))),
+	gray_c = _mm256_or_si256(_mm256_or_si256(c, _mm256_or_si256(_mm256_slli_si256(c, 4), _mm256_slli_si256(c, 8))),
+				 _mm256_or_si256(_mm256_srli_si256(b, 12), _mm256_srli_si256(b, 8)));
+
+      _mm_storeu_ps(out, _mm_castsi128_ps(_mm256_castsi256_si128(gray_a)));
+      _mm_storeu_ps(out + 4, _mm_castsi128_ps(_mm256_castsi256_si128(gray_b)));
+      _mm_storeu_ps(out + 8, _mm_castsi128_ps(_mm256_castsi256_si128(gray_c)));
+      _mm_storeu_ps(out + 12, _mm_castsi128_ps(_mm256_extracti128_si256(gray_a, 1)));
+      _mm_storeu_ps(out + 16, _mm_castsi128_ps(_mm256_extracti128_si256(gray_b, 1)));
+      _mm_storeu_ps(out + 20, _mm_castsi128_ps(_mm256_extracti128_si256(gray_c, 1)));
+    }
+  }
+
+#endif
+
+  // Set every component of pixels [0, count) of destination to the
+  // gray intensity of the same pixel of source, as fixed_point_gray
+  // computes it. Each pixel is three consecutive components. The widest
+  // kernel no wider than level runs the bulk of the row, and the scalar
+  // one the remainder. source may equal destination.
+  void gray_row(const uint8_t* source, uint8_t* destination, int count,
+		const uint16_t* weights,
+		simd_level level = detected_simd_level()) {
+    assert(count >= 0);
+    int done = 0;
+#if GFX_SIMD_X86
+    if ((level >= SIMD_AVX2) && (detected_simd_level() >= SIMD_AVX2)) {
+      done = count - count % 16;
+      gray_row_avx2(source, destination, done, weights);
+    } else if (level >= SIMD_SSE2) {
+      done = count - count % 8;
+      gray_row_sse2(source, destination, done, weights);
+    }
+#else
+    (void)level;
+#endif
+    for (int x = done; x < count; ++x) {
+      const uint8_t* in = source + 3 * x;
+      uint8_t* out = destination + 3 * x;
+      out[0] = out[1] = out[2] = fixed_point_gray(in[0], in[1], in[2], weights);
+    }
+  }
+
+  // gray_row for floating-point components, as float_gray computes
+  // them.
+  void gray_row(const float* source, float* destination, int count,
+		const float* weights,
+		simd_level level = detected_simd_level()) {
+    assert(count >= 0);
+    int done = 0;
+#if GFX_SIMD_X86
+    if ((level >= SIMD_AVX2) && (detected_simd_level() >= SIMD_AVX2)) {
+      done = count - count % 8;
+      gray_row_avx2(source, destination, done, weights);
+    } else if (level >= SIMD_SSE2) {
+      done = count - count % 4;
+      gray_row_sse2(source, destination, done, weights);
+    }
+#else
+    (void)level;
+#endif
+    for (int x = done; x < count; ++x) {
+      const float* in = source + 3 * x;
+      float* out = destination + 3 * x;
+      out[0] = out[1] = out[2] = float_gray(in[0], in[1], in[2], weights);
+    }
+  }
+
+}
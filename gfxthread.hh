@@ -0,0 +1,622 @@
+///////////////////////////////////////////////////////////////////////////////
+// gfxthread.hh
+//
+// Thread pool, work-stealing scheduler and execution policies for
+// running filters on several threads. An execution_policy is either
+// sequential, which runs everything on the calling thread, or parallel,
+// which spreads the work over the threads of a gfx::thread_pool or a
+// gfx::scheduler. Filters split their output into tiles with
+// for_each_tile, or into bands of whole rows with for_each_band, and
+// compute each pixel the same way whichever piece it falls in, so a
+// parallel run computes exactly the same pixels as a sequential one.
+//
+// For example
+//
+//     gfx::thread_pool pool(8);
+//     box_blur(gfx::parallel(pool), after, before, 5);
+//
+// blurs with eight threads, while
+//
+//     box_blur(gfx::parallel(), after, before, 5);
+//
+// uses the shared default_thread_pool() . When the cost of the rows
+// varies a lot, a scheduler balances them better:
+//
+//     gfx::scheduler tasks(8);
+//     edge_detect(gfx::parallel(tasks), after, before);
+//
+// Per-pixel filters, such as grayscale and convolve, use the tile size
+// of the policy; box_blur uses tiles the full height of the image, that
+// is strips of whole columns; filters that reuse work from one row to
+// the next, such as edge_detect, use bands.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace gfx {
+
+  // A fixed set of worker threads that run batches of tasks. The
+  // calling thread takes part in every batch, so a pool of
+  // thread_count threads starts thread_count - 1 workers, and a pool
+  // of one thread runs everything on the caller.
+  class thread_pool {
+  public:
+
+    // Start a pool of thread_count threads, which must be positive.
+    explicit thread_pool(int thread_count = default_thread_count())
+      : _thread_count(thread_count),
+	_task(nullptr),
+	_task_count(0),
+	_next_task(0),
+	_generation(0),
+	_active_workers(0),
+	_stopping(false) {
+      assert(thread_count > 0);
+      for (int i = 1; i < thread_count; ++i) {
+	_workers.emplace_back(&thread_pool::work_loop, this);
+      }
+    }
+
+    // Stops and joins the workers.
+    ~thread_pool() {
+      {
+	std::lock_guard<std::mutex> lock(_mutex);
+	_stopping = true;
+      }
+      _wake.notify_all();
+      for (auto& worker : _workers) {
+	worker.join();
+      }
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    // The number of threads that run tasks, including the caller.
+    int thread_count() const {
+      return _thread_count;
+    }
+
+    // The number of hardware threads, or 1 if that is unknown.
+    static int default_thread_count() {
+      return std::max(1, int(std::thread::hardware_concurrency()));
+    }
+
+    // Call task(i) once for every i in [0, task_count), on the workers
+    // and the calling thread, and return when every call has
+    // finished. Calls may run in any order and concurrently, so tasks
+    // must not write to shared state. If any call throws, one of the
+    // exceptions is rethrown here once the batch is done. Batches from
+    // different threads run one at a time; a task that itself calls
+    // run(...) on the same pool has its batch run on its own thread.
+    void run(int task_count, const std::function<void(int)>& task) {
+      assert(task_count >= 0);
+      if ((task_count <= 1) || _workers.empty() || (running_pool() == this)) {
+	for (int i = 0; i < task_count; ++i) {
+	  task(i);
+	}
+	return;
+      }
+
+      std::lock_guard<std::mutex> batch_lock(_batch_mutex);
+      {
+	std::lock_guard<std::mutex> lock(_mutex);
+	_task = &task;
+	_task_count = task_count;
+	_next_task = 0;
+	_error = nullptr;
+	++_generation;
+      }
+      _wake.notify_all();
+
+      run_tasks();
+
+      // Every task has been claimed; wait for workers still running
+      // one, so that none touches this batch after we return.
+      std::unique_lock<std::mutex> lock(_mutex);
+      _idle.wait(lock, [&]() { return _active_workers == 0; });
+      _task = nullptr;
+      if (_error) {
+	std::exception_ptr error = _error;
+	_error = nullptr;
+	std::rethrow_exception(error);
+      }
+    }
+
+  private:
+    const int _thread_count;
+    std::vector<std::thread> _workers;
+
+    // The current batch. _task and _task_count only change while
+    // _mutex is held and no worker is active.
+    const std::function<void(int)>* _task;
+    int _task_count;
+    std::atomic<int> _next_task;
+    std::exception_ptr _error;
+
+    unsigned _generation;
+    int _active_workers;
+    bool _stopping;
+    std::mutex _mutex, _batch_mutex;
+    std::condition_variable _wake, _idle;
+
+    // The pool whose task the current thread is running, if any.
+    static const thread_pool*& running_pool() {
+      static thread_local const thread_pool* pool = nullptr;
+      return pool;
+    }
+
+    // Claim and run tasks of the current batch until none are left.
+    void run_tasks() {
+      const thread_pool* outer = running_pool();
+      running_pool() = this;
+      for (int i; (i = _next_task.fetch_add(1)) < _task_count; ) {
+	try {
+	  (*_task)(i);
+	} catch (...) {
+	  std::lock_guard<std::mutex> lock(_mutex);
+	  if (!_error) {
+	    _error = std::current_exception();
+	  }
+	}
+      }
+      running_pool() = outer;
+    }
+
+    void work_loop() {
+      unsigned seen = 0;
+      std::unique_lock<std::mutex> lock(_mutex);
+      for (;;) {
+	_wake.wait(lock, [&]() { return _stopping || (_generation != seen); });
+	if (_stopping) {
+	  return;
+	}
+	seen = _generation;
+	if (_task == nullptr) {
+	  // Woke after that batch already finished.
+	  continue;
+	}
+	++_active_workers;
+	lock.unlock();
+	run_tasks();
+	lock.lock();
+	if (--_active_workers == 0) {
+	  _idle.notify_all();
+	}
+      }
+    }
+  };
+
+  // The pool used by gfx::parallel() when none is given. It is created
+  // on first use, with one thread per hardware thread.
+  thread_pool& default_thread_pool() {
+    static thread_pool pool;
+    return pool;
+  }
+
+  // A rectangle of pixels; see for_each_tile .
+  struct tile {
+    int left, top, width, height;
+  };
+
+  // A work-stealing scheduler for batches of tasks whose costs vary,
+  // such as the tiles of an image with busy and flat regions. Each of
+  // its threads, the caller included, has its own deque of tasks. A
+  // batch is dealt out in contiguous blocks, one per deque; a thread
+  // takes tasks from the front of its own deque and, once that is
+  // empty, steals from the back of the others', so threads that finish
+  // early take over work from those that are behind.
+  //
+  // The scheduler keeps per-thread statistics: how long each thread
+  // spent running tasks (busy) and waiting during batches (idle).
+  class scheduler {
+  public:
+
+    // Statistics for one thread. Thread 0 is the caller of run(...) .
+    struct worker_stats {
+      double busy_seconds = 0, idle_seconds = 0;
+      std::size_t tasks = 0, steals = 0;
+    };
+
+    // Start a scheduler of thread_count threads, which must be
+    // positive.
+    explicit scheduler(int thread_count = thread_pool::default_thread_count())
+      : _task(nullptr),
+	_generation(0),
+	_active_workers(0),
+	_stopping(false) {
+      assert(thread_count > 0);
+      for (int i = 0; i < thread_count; ++i) {
+	_queues.emplace_back(new queue);
+      }
+      for (int i = 1; i < thread_count; ++i) {
+	_workers.emplace_back(&scheduler::work_loop, this, i);
+      }
+    }
+
+    // Stops and joins the workers.
+    ~scheduler() {
+      {
+	std::lock_guard<std::mutex> lock(_mutex);
+	_stopping = true;
+      }
+      _wake.notify_all();
+      for (auto& worker : _workers) {
+	worker.join();
+      }
+    }
+
+    scheduler(const scheduler&) = delete;
+    scheduler& operator=(const scheduler&) = delete;
+
+    // The number of threads that run tasks, including the caller.
+    int thread_count() const {
+      return int(_queues.size());
+    }
+
+    // Call task(i) once for every i in [0, task_count), on the workers
+    // and the calling thread, and return when every call has finished,
+    // rethrowing an exception from any of them, as thread_pool::run
+    // does. A task that itself calls run(...) on the same scheduler has
+    // its batch run on its own thread.
+    void run(int task_count, const std::function<void(int)>& task) {
+      assert(task_count >= 0);
+      if ((task_count == 0) || (running_scheduler() == this)) {
+	for (int i = 0; i < task_count; ++i) {
+	  task(i);
+	}
+	return;
+      }
+
+      std::lock_guard<std::mutex> batch_lock(_batch_mutex);
+      auto start = std::chrono::steady_clock::now();
+      {
+	std::lock_guard<std::mutex> lock(_mutex);
+	const int n = thread_count();
+	for (int w = 0; w < n; ++w) {
+	  queue& q = *_queues[w];
+	  std::lock_guard<std::mutex> queue_lock(q.mutex);
+	  for (int i = int(int64_t(task_count) * w / n); i < int(int64_t(task_count) * (w + 1) / n); ++i) {
+	    q.tasks.push_back(i);
+	  }
+	  q.batch = worker_stats();
+	}
+	_task = &task;
+	_error = nullptr;
+	++_generation;
+      }
+      _wake.notify_all();
+
+      run_tasks(0);
+
+      // Every task has been claimed; wait for workers still running
+      // one, then charge the rest of the batch to each thread as idle
+      // time.
+      std::unique_lock<std::mutex> lock(_mutex);
+      _idle.wait(lock, [&]() { return _active_workers == 0; });
+      _task = nullptr;
+      double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      for (auto& q : _queues) {
+	q->total.busy_seconds += q->batch.busy_seconds;
+	q->total.idle_seconds += std::max(0.0, seconds - q->batch.busy_seconds);
+	q->total.tasks += q->batch.tasks;
+	q->total.steals += q->batch.steals;
+      }
+      if (_error) {
+	std::exception_ptr error = _error;
+	_error = nullptr;
+	std::rethrow_exception(error);
+      }
+    }
+
+    // The statistics of every thread, summed over all batches since
+    // construction or the last reset_stats(). Must not be called
+    // during a batch.
+    std::vector<worker_stats> stats() const {
+      std::vector<worker_stats> result;
+      for (auto& q : _queues) {
+	result.push_back(q->total);
+      }
+      return result;
+    }
+
+    // Zero the statistics.
+    void reset_stats() {
+      for (auto& q : _queues) {
+	q->total = worker_stats();
+      }
+    }
+
+  private:
+    struct queue {
+      std::mutex mutex;
+      std::deque<int> tasks;
+      worker_stats batch, total;
+    };
+
+    std::vector<std::unique_ptr<queue>> _queues;
+    std::vector<std::thread> _workers;
+
+    // The current batch. _task only changes while _mutex is held and
+    // no worker is active.
+    const std::function<void(int)>* _task;
+    std::exception_ptr _error;
+
+    unsigned _generation;
+    int _active_workers;
+    bool _stopping;
+    std::mutex _mutex, _batch_mutex;
+    std::condition_variable _wake, _idle;
+
+    // The scheduler whose task the current thread is running, if any.
+    static const scheduler*& running_scheduler() {
+      static thread_local const scheduler* current = nullptr;
+      return current;
+    }
+
+    // Take the next task for thread w: from the front of its own deque,
+    // or else from the back of another's. Return false when every
+    // deque is empty; no tasks are added during a batch, so the batch
+    // has then been claimed in full.
+    bool take(int w, int& task) {
+      const int n = thread_count();
+      for (int k = 0; k < n; ++k) {
+	queue& q = *_queues[(w + k) % n];
+	std::lock_guard<std::mutex> lock(q.mutex);
+	if (q.tasks.empty()) {
+	  continue;
+	}
+	if (k == 0) {
+	  task = q.tasks.front();
+	  q.tasks.pop_front();
+	} else {
+	  task = q.tasks.back();
+	  q.tasks.pop_back();
+	  ++_queues[w]->batch.steals;
+	}
+	return true;
+      }
+      return false;
+    }
+
+    // Run tasks of the current batch as thread w until none are left.
+    void run_tasks(int w) {
+      const scheduler* outer = running_scheduler();
+      running_scheduler() = this;
+      worker_stats& batch = _queues[w]->batch;
+      for (int i; take(w, i); ) {
+	auto start = std::chrono::steady_clock::now();
+	try {
+	  (*_task)(i);
+	} catch (...) {
+	  std::lock_guard<std::mutex> lock(_mutex);
+	  if (!_error) {
+	    _error = std::current_exception();
+	  }
+	}
+	batch.busy_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	++batch.tasks;
+      }
+      running_scheduler() = outer;
+    }
+
+    void work_loop(int w) {
+      unsigned seen = 0;
+      std::unique_lock<std::mutex> lock(_mutex);
+      for (;;) {
+	_wake.wait(lock, [&]() { return _stopping || (_generation != seen); });
+	if (_stopping) {
+	  return;
+	}
+	seen = _generation;
+	if (_task == nullptr) {
+	  // Woke after that batch already finished.
+	  continue;
+	}
+	++_active_workers;
+	lock.unlock();
+	run_tasks(w);
+	lock.lock();
+	if (--_active_workers == 0) {
+	  _idle.notify_all();
+	}
+      }
+    }
+  };
+
+  // The size of a tile when the policy does not ask for another: as
+  // many rows as a band, and wide enough to stream each row segment
+  // efficiently, with a few hundred tiles in a 1920 x 1080 frame.
+  const int DEFAULT_TILE_WIDTH = 256,
+    DEFAULT_TILE_HEIGHT = 32;
+
+  // How a filter runs: sequentially on the calling thread, or in
+  // parallel on a thread_pool or a work-stealing scheduler. Construct
+  // one with gfx::sequential() or gfx::parallel(...) . A policy also
+  // sets the tile size of for_each_tile. A policy only refers to its
+  // pool or scheduler, which must outlive it.
+  class execution_policy {
+  public:
+
+    // Sequential execution.
+    execution_policy()
+      : _pool(nullptr),
+	_scheduler(nullptr),
+	_tile_width(DEFAULT_TILE_WIDTH),
+	_tile_height(DEFAULT_TILE_HEIGHT) { }
+
+    // Parallel execution on pool.
+    explicit execution_policy(thread_pool& pool)
+      : _pool(&pool),
+	_scheduler(nullptr),
+	_tile_width(DEFAULT_TILE_WIDTH),
+	_tile_height(DEFAULT_TILE_HEIGHT) { }
+
+    // Parallel execution on a work-stealing scheduler, which balances
+    // bands or tiles of uneven cost.
+    explicit execution_policy(gfx::scheduler& tasks)
+      : _pool(nullptr),
+	_scheduler(&tasks),
+	_tile_width(DEFAULT_TILE_WIDTH),
+	_tile_height(DEFAULT_TILE_HEIGHT) { }
+
+    // Return a copy of this policy whose tiles are width x height
+    // pixels; both must be positive.
+    execution_policy with_tile_size(int width,
+				    int height) const {
+      assert(width > 0);
+      assert(height > 0);
+      execution_policy result(*this);
+      result._tile_width = width;
+      result._tile_height = height;
+      return result;
+    }
+
+    // The size of the tiles that for_each_tile(policy, ...) covers an
+    // image with.
+    int tile_width() const {
+      return _tile_width;
+    }
+    int tile_height() const {
+      return _tile_height;
+    }
+
+    // Return true when work may be spread over more than one thread.
+    bool is_parallel() const {
+      return ((_pool != nullptr) && (_pool->thread_count() > 1)) ||
+	((_scheduler != nullptr) && (_scheduler->thread_count() > 1));
+    }
+
+    // The pool of a thread_pool policy, otherwise nullptr.
+    thread_pool* pool() const {
+      return _pool;
+    }
+
+    // The scheduler of a work-stealing policy, otherwise nullptr.
+    gfx::scheduler* work_scheduler() const {
+      return _scheduler;
+    }
+
+    // Call task(i) once for every i in [0, task_count): in order on the
+    // calling thread when sequential, otherwise as one batch on the
+    // pool or scheduler.
+    void run(int task_count, const std::function<void(int)>& task) const {
+      if (!is_parallel()) {
+	for (int i = 0; i < task_count; ++i) {
+	  task(i);
+	}
+      } else if (_pool != nullptr) {
+	_pool->run(task_count, task);
+      } else {
+	_scheduler->run(task_count, task);
+      }
+    }
+
+  private:
+    thread_pool* _pool;
+    gfx::scheduler* _scheduler;
+    int _tile_width, _tile_height;
+  };
+
+  // Return a policy that runs on the calling thread.
+  execution_policy sequential() {
+    return execution_policy();
+  }
+
+  // Return a policy that runs on pool, by default the shared
+  // default_thread_pool() .
+  execution_policy parallel(thread_pool& pool = default_thread_pool()) {
+    return execution_policy(pool);
+  }
+
+  // Return a policy that runs on a work-stealing scheduler.
+  execution_policy parallel(scheduler& tasks) {
+    return execution_policy(tasks);
+  }
+
+  // The number of rows in a band when a filter does not ask for more:
+  // enough work per band to outweigh handing it to a thread, and enough
+  // bands to keep a large pool busy on a 1080-row frame.
+  const int DEFAULT_BAND_HEIGHT = 32;
+
+  // The number of columns in a strip, for filters that split the image
+  // into strips of whole columns with for_each_tile instead: about as
+  // many pixels per strip of a 1080-row frame as in a band, with enough
+  // strips across a 1920-column one.
+  const int DEFAULT_STRIP_WIDTH = 64;
+
+  // Split the rows [0, height) into consecutive bands of band_height
+  // rows, the last one possibly shorter, and call band(y_begin, y_end)
+  // once for each, according to policy. height must be non-negative and
+  // band_height positive. Sequentially the bands run in order from the
+  // top; in parallel they run concurrently, so band must only write
+  // rows inside its own band.
+  template <typename band_function>
+  void for_each_band(const execution_policy& policy,
+		     int height,
+		     int band_height,
+		     band_function band) {
+    assert(height >= 0);
+    assert(band_height > 0);
+    int band_count = (height + band_height - 1) / band_height;
+    policy.run(band_count, [&](int i) {
+	int y_begin = i * band_height;
+	band(y_begin, std::min(height, y_begin + band_height));
+      });
+  }
+
+  // Cover the width x height rectangle with tiles of tile_width x
+  // tile_height pixels, those on the right and bottom edges clipped to
+  // fit, and call f(t) once for each tile t, according to
+  // policy. Sequentially the tiles run in row-major order; in parallel
+  // they run concurrently, so f must only write pixels inside its own
+  // tile. Every argument must be positive.
+  template <typename tile_function>
+  void for_each_tile(const execution_policy& policy,
+		     int width,
+		     int height,
+		     int tile_width,
+		     int tile_height,
+		     tile_function f) {
+    assert(width > 0);
+    assert(height > 0);
+    assert(tile_width > 0);
+    assert(tile_height > 0);
+    const int columns = (width + tile_width - 1) / tile_width,
+      rows = (height + tile_height - 1) / tile_height;
+    policy.run(columns * rows, [&](int i) {
+	tile t;
+	t.left = (i % columns) * tile_width;
+	t.top = (i / columns) * tile_height;
+	t.width = std::min(tile_width, width - t.left);
+	t.height = std::min(tile_height, height - t.top);
+	f(t);
+      });
+  }
+
+  // for_each_tile with the tile size of policy (see
+  // execution_policy::with_tile_size), for filters whose pixels do not
+  // depend on the tiles they are computed in.
+  template <typename tile_function>
+  void for_each_tile(const execution_policy& policy,
+		     int width,
+		     int height,
+		     tile_function f) {
+    for_each_tile(policy, width, height, policy.tile_width(), policy.tile_height(), f);
+  }
+}